@@ -0,0 +1,534 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "cache.h"
+#include "thread.h"
+#include "log.h"
+#include "deps/miniz/miniz.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define cache_mkdir(path) _mkdir(path)
+#define cache_getpid() ((unsigned long)_getpid())
+#define cache_getcwd(buf, size) _getcwd(buf, (int)(size))
+#define cache_path_absolute(path) \
+    ((path)[0] == '/' || (path)[0] == '\\' || ((path)[0] != '\0' && (path)[1] == ':'))
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define cache_mkdir(path) mkdir(path, 0777)
+#define cache_getpid() ((unsigned long)getpid())
+#define cache_getcwd(buf, size) getcwd(buf, size)
+#define cache_path_absolute(path) ((path)[0] == '/')
+#endif
+
+#define CACHE_MAGIC "CVBC"
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_HEADER_SIZE (4 + 1 + 1 + 4 + 4 + CACHE_KEY_SIZE + 4)
+#define CACHE_STATE_SUFFIX ".state"
+
+static struct
+{
+    bool enabled;
+    char *dir;
+    struct thread_mutex lock;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long nr_temp;
+    size_t state_size;
+} cache;
+
+static void cache_wr32(uint8_t *addr, uint32_t value)
+{
+    addr[0] = (value >> 0) & 0xff;
+    addr[1] = (value >> 8) & 0xff;
+    addr[2] = (value >> 16) & 0xff;
+    addr[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t cache_rd32(const uint8_t *addr)
+{
+    return ((uint32_t)addr[0] << 0) |
+           ((uint32_t)addr[1] << 8) |
+           ((uint32_t)addr[2] << 16) |
+           ((uint32_t)addr[3] << 24);
+}
+
+void cache_init(const char *dir)
+{
+    size_t len;
+
+    if (cache.enabled || dir == NULL || *dir == '\0')
+    {
+        return;
+    }
+
+    if (cache_mkdir(dir) != 0 && errno != EEXIST)
+    {
+        LOG_WARNING("Cannot create cache directory \'%s\': %s\n",
+            dir, strerror(errno));
+        return;
+    }
+
+    len = strlen(dir);
+    cache.dir = malloc(len + 1);
+    if (cache.dir == NULL)
+    {
+        LOG_WARNING("Out of memory, compression cache disabled.\n");
+        return;
+    }
+
+    memcpy(cache.dir, dir, len + 1);
+
+    if (thread_mutex_init(&cache.lock) != 0)
+    {
+        free(cache.dir);
+        cache.dir = NULL;
+        return;
+    }
+
+    cache.hits = 0;
+    cache.misses = 0;
+    cache.nr_temp = 0;
+    cache.state_size = 0;
+    cache.enabled = true;
+
+    LOG_DEBUG("Using compression cache \'%s\'.\n", dir);
+}
+
+void cache_free(void)
+{
+    if (!cache.enabled)
+    {
+        return;
+    }
+
+    if (cache.hits + cache.misses > 0)
+    {
+        LOG_INFO("Compression cache: %lu hit(s), %lu miss(es).\n",
+            cache.hits, cache.misses);
+    }
+
+    thread_mutex_destroy(&cache.lock);
+    free(cache.dir);
+    cache.dir = NULL;
+    cache.enabled = false;
+}
+
+bool cache_enabled(void)
+{
+    return cache.enabled;
+}
+
+void cache_key(const uint8_t *data,
+               size_t size,
+               const uint8_t *params,
+               size_t params_size,
+               uint8_t key[CACHE_KEY_SIZE])
+{
+    static const char version[] = VERSION_STRING;
+    struct sha256 sha;
+    uint8_t buf[8];
+    unsigned int i;
+
+    sha256_init(&sha);
+
+    sha256_update(&sha, CACHE_MAGIC, 4);
+    sha256_update(&sha, version, sizeof version);
+
+    cache_wr32(buf, params_size);
+    sha256_update(&sha, buf, 4);
+    sha256_update(&sha, params, params_size);
+
+    for (i = 0; i < 8; ++i)
+    {
+        buf[i] = ((uint64_t)size >> (i * 8)) & 0xff;
+    }
+    sha256_update(&sha, buf, 8);
+    sha256_update(&sha, data, size);
+
+    sha256_final(&sha, key);
+}
+
+/*
+ * Keys a state entry on the absolute form of path, so files of the same name
+ * in different directories or projects sharing the cache do not collide.
+ * A relative path is taken against the current directory; if that cannot be
+ * found, path is used as given.
+ */
+void cache_state_key(const char *path,
+                     const uint8_t *params,
+                     size_t params_size,
+                     uint8_t key[CACHE_KEY_SIZE])
+{
+    size_t path_len = strlen(path);
+    size_t cwd_size = 256;
+    char *full = NULL;
+
+    while (!cache_path_absolute(path))
+    {
+        char *buf = realloc(full, cwd_size + 1 + path_len);
+        if (buf == NULL)
+        {
+            break;
+        }
+        full = buf;
+
+        if (cache_getcwd(full, cwd_size) != NULL)
+        {
+            size_t cwd_len = strlen(full);
+
+            full[cwd_len] = '/';
+            memcpy(full + cwd_len + 1, path, path_len);
+            cache_key((const uint8_t *)full, cwd_len + 1 + path_len, params, params_size, key);
+            free(full);
+            return;
+        }
+
+        if (errno != ERANGE)
+        {
+            break;
+        }
+        cwd_size *= 2;
+    }
+
+    free(full);
+
+    cache_key((const uint8_t *)path, path_len, params, params_size, key);
+}
+
+static char *cache_entry_path(const uint8_t key[CACHE_KEY_SIZE], const char *suffix)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t dir_len = strlen(cache.dir);
+    size_t suffix_len = strlen(suffix);
+    char *path;
+    char *p;
+    unsigned int i;
+
+    path = malloc(dir_len + 1 + CACHE_KEY_SIZE * 2 + suffix_len + 1);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(path, cache.dir, dir_len);
+    p = path + dir_len;
+    *p++ = '/';
+
+    for (i = 0; i < CACHE_KEY_SIZE; ++i)
+    {
+        *p++ = hex[key[i] >> 4];
+        *p++ = hex[key[i] & 15];
+    }
+
+    memcpy(p, suffix, suffix_len + 1);
+
+    return path;
+}
+
+static int cache_read_entry(const char *path,
+                            const uint8_t key[CACHE_KEY_SIZE],
+                            uint8_t **data,
+                            size_t *size,
+                            int32_t *delta,
+                            compress_mode_t *mode)
+{
+    uint8_t header[CACHE_HEADER_SIZE];
+    uint8_t *entry_data = NULL;
+    uint32_t entry_size;
+    compress_mode_t entry_mode;
+    FILE *fd;
+
+    fd = fopen(path, "rb");
+    if (fd == NULL)
+    {
+        return -1;
+    }
+
+    if (fread(header, CACHE_HEADER_SIZE, 1, fd) != 1 ||
+        memcmp(header, CACHE_MAGIC, 4) != 0 ||
+        header[4] != CACHE_FORMAT_VERSION ||
+        memcmp(header + 14, key, CACHE_KEY_SIZE) != 0)
+    {
+        goto fail;
+    }
+
+    entry_mode = (compress_mode_t)header[5];
+    entry_size = cache_rd32(header + 10);
+    if (entry_size == 0)
+    {
+        goto fail;
+    }
+
+    entry_data = malloc(entry_size);
+    if (entry_data == NULL)
+    {
+        goto fail;
+    }
+
+    if (fread(entry_data, entry_size, 1, fd) != 1 ||
+        fgetc(fd) != EOF ||
+        mz_crc32(MZ_CRC32_INIT, entry_data, entry_size) != cache_rd32(header + 14 + CACHE_KEY_SIZE))
+    {
+        goto fail;
+    }
+
+    fclose(fd);
+
+    *data = entry_data;
+    *size = entry_size;
+    *delta = (int32_t)cache_rd32(header + 6);
+    *mode = entry_mode;
+
+    return 0;
+
+fail:
+    free(entry_data);
+    fclose(fd);
+    return -1;
+}
+
+int cache_lookup(const uint8_t key[CACHE_KEY_SIZE],
+                 uint8_t **data,
+                 size_t *size,
+                 int32_t *delta,
+                 compress_mode_t *mode)
+{
+    char *path;
+    int ret;
+
+    if (!cache.enabled || key == NULL || data == NULL || size == NULL || delta == NULL || mode == NULL)
+    {
+        return -1;
+    }
+
+    path = cache_entry_path(key, "");
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    ret = cache_read_entry(path, key, data, size, delta, mode);
+    if (ret == 0 && *mode != COMPRESS_ZX7 && *mode != COMPRESS_ZX0)
+    {
+        free(*data);
+        *data = NULL;
+        ret = -1;
+    }
+
+    LOG_DEBUG("Compression cache %s \'%s\'.\n", ret == 0 ? "hit" : "miss", path);
+
+    free(path);
+
+    thread_mutex_lock(&cache.lock);
+    if (ret == 0)
+    {
+        cache.hits++;
+    }
+    else
+    {
+        cache.misses++;
+    }
+    thread_mutex_unlock(&cache.lock);
+
+    return ret;
+}
+
+/*
+ * Writes an entry to a temporary file and renames it to the key's path plus
+ * path_suffix. If replace is set, an existing entry is overwritten.
+ */
+static int cache_write_entry(const uint8_t key[CACHE_KEY_SIZE],
+                             const char *path_suffix,
+                             bool replace,
+                             const uint8_t *data,
+                             size_t size,
+                             int32_t delta,
+                             compress_mode_t mode)
+{
+    uint8_t header[CACHE_HEADER_SIZE];
+    char suffix[64];
+    char *temp_path = NULL;
+    char *path = NULL;
+    unsigned long nr_temp;
+    FILE *fd;
+    int ret = -1;
+
+    if (!cache.enabled || key == NULL || data == NULL || size == 0 || size > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    thread_mutex_lock(&cache.lock);
+    nr_temp = cache.nr_temp++;
+    thread_mutex_unlock(&cache.lock);
+
+    /* unique per process and per store, so concurrent writers never collide */
+    sprintf(suffix, ".%lu.%lu.tmp", cache_getpid(), nr_temp);
+
+    path = cache_entry_path(key, path_suffix);
+    temp_path = cache_entry_path(key, suffix);
+    if (path == NULL || temp_path == NULL)
+    {
+        goto cleanup;
+    }
+
+    memcpy(header, CACHE_MAGIC, 4);
+    header[4] = CACHE_FORMAT_VERSION;
+    header[5] = (uint8_t)mode;
+    cache_wr32(header + 6, (uint32_t)delta);
+    cache_wr32(header + 10, (uint32_t)size);
+    memcpy(header + 14, key, CACHE_KEY_SIZE);
+    cache_wr32(header + 14 + CACHE_KEY_SIZE, mz_crc32(MZ_CRC32_INIT, data, size));
+
+    fd = fopen(temp_path, "wb");
+    if (fd == NULL)
+    {
+        LOG_WARNING("Cannot write cache entry \'%s\': %s\n",
+            temp_path, strerror(errno));
+        goto cleanup;
+    }
+
+    if (fwrite(header, CACHE_HEADER_SIZE, 1, fd) != 1 ||
+        fwrite(data, size, 1, fd) != 1)
+    {
+        LOG_WARNING("Cannot write cache entry \'%s\'.\n", temp_path);
+        fclose(fd);
+        remove(temp_path);
+        goto cleanup;
+    }
+
+    if (fclose(fd) != 0)
+    {
+        remove(temp_path);
+        goto cleanup;
+    }
+
+    /* another process may have published the same entry first */
+    if (rename(temp_path, path) != 0)
+    {
+        /* rename does not replace an existing file on every platform */
+        if (!replace || remove(path) != 0 || rename(temp_path, path) != 0)
+        {
+            remove(temp_path);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    free(temp_path);
+    free(path);
+
+    return ret;
+}
+
+int cache_store(const uint8_t key[CACHE_KEY_SIZE],
+                const uint8_t *data,
+                size_t size,
+                int32_t delta,
+                compress_mode_t mode)
+{
+    return cache_write_entry(key, "", false, data, size, delta, mode);
+}
+
+int cache_load_state(const uint8_t key[CACHE_KEY_SIZE],
+                     uint8_t **data,
+                     size_t *size)
+{
+    compress_mode_t mode;
+    int32_t delta;
+    char *path;
+    int ret;
+
+    if (!cache.enabled || key == NULL || data == NULL || size == NULL)
+    {
+        return -1;
+    }
+
+    path = cache_entry_path(key, CACHE_STATE_SUFFIX);
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    ret = cache_read_entry(path, key, data, size, &delta, &mode);
+    if (ret == 0 && mode != COMPRESS_NONE)
+    {
+        free(*data);
+        *data = NULL;
+        ret = -1;
+    }
+
+    LOG_DEBUG("Compression state %s \'%s\'.\n", ret == 0 ? "loaded" : "not found", path);
+
+    free(path);
+
+    return ret;
+}
+
+int cache_store_state(const uint8_t key[CACHE_KEY_SIZE],
+                      const uint8_t *data,
+                      size_t size)
+{
+    bool full;
+
+    if (!cache.enabled || key == NULL || data == NULL)
+    {
+        return -1;
+    }
+
+    thread_mutex_lock(&cache.lock);
+    full = size > CACHE_STATE_MAX_TOTAL - cache.state_size;
+    if (!full)
+    {
+        cache.state_size += size;
+    }
+    thread_mutex_unlock(&cache.lock);
+
+    if (full)
+    {
+        LOG_DEBUG("Compression state limit reached, not storing state.\n");
+        return -1;
+    }
+
+    return cache_write_entry(key, CACHE_STATE_SUFFIX, true, data, size, 0, COMPRESS_NONE);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "compress.h"
+#include "sha256.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_ENV_DIR "CONVBIN_CACHE_DIR"
+#define CACHE_KEY_SIZE SHA256_DIGEST_SIZE
+
+/*
+ * On-disk cache of compressed streams, keyed on a hash of the input bytes,
+ * the codec and its parameters, and the program version. Entries are written
+ * to a temporary file and renamed into place, so any number of processes may
+ * share one cache directory.
+ */
+void cache_init(const char *dir);
+
+void cache_free(void);
+
+bool cache_enabled(void);
+
+void cache_key(const uint8_t *data,
+               size_t size,
+               const uint8_t *params,
+               size_t params_size,
+               uint8_t key[CACHE_KEY_SIZE]);
+
+int cache_lookup(const uint8_t key[CACHE_KEY_SIZE],
+                 uint8_t **data,
+                 size_t *size,
+                 int32_t *delta,
+                 compress_mode_t *mode);
+
+int cache_store(const uint8_t key[CACHE_KEY_SIZE],
+                const uint8_t *data,
+                size_t size,
+                int32_t delta,
+                compress_mode_t mode);
+
+/*
+ * State entries hold data reused across runs that is looked up by name
+ * rather than by content, such as optimizer checkpoints. Storing replaces
+ * the previous entry for the key. They are not counted as hits or misses.
+ * A run stores at most CACHE_STATE_MAX_TOTAL bytes of state; stores past
+ * that fail.
+ */
+#define CACHE_STATE_MAX_TOTAL (64UL * 1024 * 1024)
+
+void cache_state_key(const char *path,
+                     const uint8_t *params,
+                     size_t params_size,
+                     uint8_t key[CACHE_KEY_SIZE]);
+
+int cache_load_state(const uint8_t key[CACHE_KEY_SIZE],
+                     uint8_t **data,
+                     size_t *size);
+
+int cache_store_state(const uint8_t key[CACHE_KEY_SIZE],
+                      const uint8_t *data,
+                      size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
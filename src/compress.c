@@ -29,193 +29,1664 @@
  */
 
 #include "compress.h"
+#include "cache.h"
+#include "decompress.h"
 #include "input.h"
+#include "thread.h"
 #include "ti8x.h"
 #include "log.h"
+#include "zx7.h"
 
-#include "deps/zx/zx7/zx7.h"
-#include "deps/zx/zx0/zx0.h"
+#include "asm/zx7_decompressor.h"
+#include "asm/zx0_decompressor.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define COMPRESS_PROBE_HASH_BITS 15
+#define COMPRESS_PROBE_SAMPLES 4096
+#define COMPRESS_PROBE_MIN_MATCH 4
+#define COMPRESS_ENTROPY_LIMIT 7.9
+
+struct compress_level
+{
+    int zx0_max_offset;
+    int zx7_max_offset;
+    size_t zx7_max_length;
+};
+
+/* see the compression levels table in README.md for measured trade-offs */
+static const struct compress_level compress_levels[COMPRESS_LEVEL_MAX] =
+{
+    {                  256,            256,         256 },
+    {                 1024,           1024,        4096 },
+    { ZX0_QUICK_MAX_OFFSET, ZX7_MAX_OFFSET, ZX7_MAX_LEN },
+    {                 8192, ZX7_MAX_OFFSET, ZX7_MAX_LEN },
+    {       ZX0_MAX_OFFSET, ZX7_MAX_OFFSET, ZX7_MAX_LEN },
+};
+
+static const struct compress_options compress_default_options =
+{
+    COMPRESS_LEVEL_DEFAULT,
+    0,
+    0,
+    COMPRESS_GOAL_SIZE,
+    false,
+    false,
+    false,
+};
+
+void compress_options_init(struct compress_options *options)
+{
+    *options = compress_default_options;
+}
+
+static const struct compress_level *compress_level(const struct compress_ctx *ctx)
+{
+    int level = ctx->options->level;
+
+    if (level < COMPRESS_LEVEL_MIN || level > COMPRESS_LEVEL_MAX)
+    {
+        level = COMPRESS_LEVEL_DEFAULT;
+    }
+
+    return &compress_levels[level - 1];
+}
+
+static void compress_wr24(uint8_t *addr, uint32_t value)
+{
+    addr[0] = (value >> 0) & 0xff;
+    addr[1] = (value >> 8) & 0xff;
+    addr[2] = (value >> 16) & 0xff;
+}
+
+static void compress_wr32(uint8_t *addr, uint32_t value)
+{
+    addr[0] = (value >> 0) & 0xff;
+    addr[1] = (value >> 8) & 0xff;
+    addr[2] = (value >> 16) & 0xff;
+    addr[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t compress_rd32(const uint8_t *addr)
+{
+    return ((uint32_t)addr[0] << 0) |
+           ((uint32_t)addr[1] << 8) |
+           ((uint32_t)addr[2] << 16) |
+           ((uint32_t)addr[3] << 24);
+}
+
+/*
+ * zx7 parse checkpoints are cache state entries keyed on the path of the file
+ * they were taken for, so a later run can find them after the data has changed.
+ * An entry holds a header of size, skip, offset limit, length limit and
+ * number of snapshots, then the data, the bits, offset and length of each
+ * position's parse, and the min and max snapshots, all as 32-bit values.
+ */
+#define COMPRESS_CHECKPOINT_HEADER_LEN (5 * 4)
+
+static void compress_checkpoint_key(const struct compress_ctx *ctx,
+                                    const char *name, uint8_t key[CACHE_KEY_SIZE])
+{
+    uint8_t params[9];
+
+    params[0] = COMPRESS_ZX7;
+    compress_wr32(params + 1, compress_level(ctx)->zx7_max_offset);
+    compress_wr32(params + 5, compress_level(ctx)->zx7_max_length);
+
+    cache_state_key(name, params, sizeof params, key);
+}
+
+/*
+ * Loads the checkpoint saved under name and finds where the data first
+ * differs from the data it was taken for. On success, previous holds the
+ * earlier parse up to resume and checkpoint its snapshots, and unchanged is
+ * set if the data is the same as before, so the checkpoint need not be
+ * stored again.
+ */
+static int compress_checkpoint_load(const struct compress_ctx *ctx,
+                                    const char *name,
+                                    const uint8_t *data,
+                                    size_t size,
+                                    size_t skip,
+                                    struct zx7_optimal **previous,
+                                    size_t *resume,
+                                    struct zx7_checkpoint *checkpoint,
+                                    bool *unchanged)
+{
+    uint8_t key[CACHE_KEY_SIZE];
+    struct zx7_optimal *optimal = NULL;
+    uint8_t *state = NULL;
+    const uint8_t *addr;
+    size_t state_size;
+    size_t old_size;
+    size_t nr_snapshots;
+    size_t stride;
+    size_t same;
+    size_t i;
+
+    compress_checkpoint_key(ctx, name, key);
+
+    if (cache_load_state(key, &state, &state_size) != 0)
+    {
+        return -1;
+    }
+
+    if (state_size < COMPRESS_CHECKPOINT_HEADER_LEN)
+    {
+        goto fail;
+    }
+
+    old_size = compress_rd32(state + 0);
+    nr_snapshots = compress_rd32(state + 16);
+    stride = (size_t)compress_level(ctx)->zx7_max_offset + 1;
+
+    if (old_size == 0 ||
+        compress_rd32(state + 4) != skip ||
+        compress_rd32(state + 8) != (uint32_t)compress_level(ctx)->zx7_max_offset ||
+        compress_rd32(state + 12) != compress_level(ctx)->zx7_max_length ||
+        nr_snapshots != (old_size - 1) / ZX7_CHECKPOINT_INTERVAL + 1 ||
+        state_size != COMPRESS_CHECKPOINT_HEADER_LEN + old_size * (1 + 3 * 4) +
+            nr_snapshots * stride * 2 * 4)
+    {
+        goto fail;
+    }
+
+    addr = state + COMPRESS_CHECKPOINT_HEADER_LEN;
+
+    for (same = 0; same < old_size && same < size; ++same)
+    {
+        if (addr[same] != data[same])
+        {
+            break;
+        }
+    }
+
+    *unchanged = same == old_size && same == size;
+
+    /* resume from the last snapshot both parses have */
+    if (same >= old_size)
+    {
+        same = old_size - 1;
+    }
+    if (same >= size)
+    {
+        same = size - 1;
+    }
+
+    *resume = same - same % ZX7_CHECKPOINT_INTERVAL;
+    if (*resume <= skip)
+    {
+        goto fail;
+    }
+
+    addr += old_size;
+
+    optimal = malloc(*resume * sizeof(struct zx7_optimal));
+    checkpoint->min = malloc(nr_snapshots * stride * sizeof(uint32_t));
+    checkpoint->max = malloc(nr_snapshots * stride * sizeof(uint32_t));
+    if (optimal == NULL || checkpoint->min == NULL || checkpoint->max == NULL)
+    {
+        goto fail;
+    }
+
+    for (i = 0; i < *resume; ++i)
+    {
+        optimal[i].bits = compress_rd32(addr + i * 12 + 0);
+        optimal[i].offset = (int)compress_rd32(addr + i * 12 + 4);
+        optimal[i].len = (int)compress_rd32(addr + i * 12 + 8);
+    }
+
+    addr += old_size * 12;
+
+    for (i = 0; i < nr_snapshots * stride; ++i)
+    {
+        checkpoint->min[i] = compress_rd32(addr + i * 4);
+        checkpoint->max[i] = compress_rd32(addr + (nr_snapshots * stride + i) * 4);
+    }
+
+    checkpoint->offset_limit = compress_level(ctx)->zx7_max_offset;
+    checkpoint->nr_snapshots = nr_snapshots;
+
+    free(state);
+
+    *previous = optimal;
+
+    return 0;
+
+fail:
+    zx7_checkpoint_free(checkpoint);
+    free(optimal);
+    free(state);
+    return -1;
+}
+
+static void compress_checkpoint_store(const struct compress_ctx *ctx,
+                                      const char *name,
+                                      const uint8_t *data,
+                                      size_t size,
+                                      size_t skip,
+                                      const struct zx7_optimal *optimal,
+                                      const struct zx7_checkpoint *checkpoint)
+{
+    uint8_t key[CACHE_KEY_SIZE];
+    size_t stride = (size_t)checkpoint->offset_limit + 1;
+    size_t nr_values = checkpoint->nr_snapshots * stride;
+    size_t state_size;
+    uint8_t *state;
+    uint8_t *addr;
+    size_t i;
+
+    state_size = COMPRESS_CHECKPOINT_HEADER_LEN + size * (1 + 3 * 4) + nr_values * 2 * 4;
+
+    state = malloc(state_size);
+    if (state == NULL)
+    {
+        return;
+    }
+
+    compress_wr32(state + 0, size);
+    compress_wr32(state + 4, skip);
+    compress_wr32(state + 8, checkpoint->offset_limit);
+    compress_wr32(state + 12, compress_level(ctx)->zx7_max_length);
+    compress_wr32(state + 16, checkpoint->nr_snapshots);
+
+    addr = state + COMPRESS_CHECKPOINT_HEADER_LEN;
+    memcpy(addr, data, size);
+    addr += size;
+
+    for (i = 0; i < size; ++i)
+    {
+        compress_wr32(addr + 0, optimal[i].bits);
+        compress_wr32(addr + 4, optimal[i].offset);
+        compress_wr32(addr + 8, optimal[i].len);
+        addr += 12;
+    }
+
+    for (i = 0; i < nr_values; ++i)
+    {
+        compress_wr32(addr + i * 4, checkpoint->min[i]);
+        compress_wr32(addr + (nr_values + i) * 4, checkpoint->max[i]);
+    }
+
+    compress_checkpoint_key(ctx, name, key);
+    cache_store_state(key, state, state_size);
+
+    free(state);
+}
+
+/*
+ * Optimal zx7 parse that picks up the checkpoint saved under name, if any,
+ * and saves a new one. Only the positions from the last snapshot before the
+ * first changed byte are parsed again; the result is the same as a full
+ * parse.
+ */
+static struct zx7_optimal *compress_zx7_optimize_checkpoint(struct compress_ctx *ctx,
+                                                            const uint8_t *data,
+                                                            size_t size,
+                                                            size_t skip,
+                                                            const char *name)
+{
+    struct zx7_checkpoint checkpoint;
+    struct zx7_optimal *previous = NULL;
+    struct zx7_optimal *opt;
+    size_t resume = 0;
+    bool unchanged = false;
+
+    zx7_checkpoint_init(&checkpoint);
+
+    if (compress_checkpoint_load(ctx, name, data, size, skip, &previous, &resume,
+                                 &checkpoint, &unchanged) == 0)
+    {
+        LOG_DEBUG("Resuming zx7 parse at byte %lu of %lu.\n",
+            (unsigned long)(resume - skip), (unsigned long)(size - skip));
+    }
+
+    opt = zx7_optimize_resume(&ctx->zx7, data, size, skip,
+                              compress_level(ctx)->zx7_max_offset,
+                              compress_level(ctx)->zx7_max_length,
+                              previous, resume, &checkpoint);
+    if (opt != NULL && !unchanged)
+    {
+        compress_checkpoint_store(ctx, name, data, size, skip, opt, &checkpoint);
+    }
+
+    zx7_checkpoint_free(&checkpoint);
+    free(previous);
+
+    return opt;
+}
+
+/*
+ * Parses data[skip..size) for zx7. Neither parser reads the context's match
+ * index: the optimal one keeps its own window-sized tables and the fast one
+ * its match probe. A checkpoint name enables resuming the parse when the
+ * cache is in use.
+ */
+static struct zx7_optimal *compress_zx7_optimize(struct compress_ctx *ctx,
+                                                 const uint8_t *data,
+                                                 size_t size,
+                                                 size_t skip,
+                                                 const char *checkpoint)
+{
+    struct zx7_optimal *opt;
+
+    if (ctx->options->fast)
+    {
+        opt = zx7_optimize_fast(&ctx->zx7, data, size, skip,
+                                compress_level(ctx)->zx7_max_offset,
+                                compress_level(ctx)->zx7_max_length);
+    }
+    else if (checkpoint != NULL && cache_enabled())
+    {
+        opt = compress_zx7_optimize_checkpoint(ctx, data, size, skip, checkpoint);
+    }
+    else
+    {
+        opt = zx7_optimize(&ctx->zx7, data, size, skip,
+                           compress_level(ctx)->zx7_max_offset,
+                           compress_level(ctx)->zx7_max_length);
+    }
+    if (opt == NULL)
+    {
+        LOG_ERROR("Could not optimize zx7.\n");
+    }
+
+    return opt;
+}
+
+static int compress_zx7(struct compress_ctx *ctx,
+                        const uint8_t *data,
+                        size_t size,
+                        size_t skip,
+                        uint8_t **zx7_data,
+                        size_t *zx7_size,
+                        int32_t *delta)
+{
+    struct zx7_optimal *opt;
+    uint8_t *compressed_data;
+    size_t new_size;
+    long new_delta;
+
+    if (ctx == NULL || data == NULL || zx7_data == NULL)
+    {
+        return -1;
+    }
+
+    opt = compress_zx7_optimize(ctx, data, size, skip, ctx->checkpoint);
+    if (opt == NULL)
+    {
+        return -1;
+    }
+
+    compressed_data = zx7_compress(opt, data, size, skip, &new_size, &new_delta);
+    free(opt);
+    if (compressed_data == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    *zx7_data = compressed_data;
+    *zx7_size = new_size;
+    *delta = new_delta;
+
+    return 0;
+}
+
+static void compress_zx0_progress(void)
+{
+    LOG_PRINT(".");
+}
+
+/*
+ * Parses data[skip..size) for zx0. The optimal parser reads the context's
+ * match index, which must already be built for data.
+ */
+static struct zx0_block *compress_zx0_optimize(struct compress_ctx *ctx,
+                                               const uint8_t *data,
+                                               size_t size,
+                                               size_t skip)
+{
+    struct zx0_block *optimal;
+    int offset_limit;
+    int level;
+
+    if (size > INT32_MAX)
+    {
+        LOG_ERROR("Input too large.\n");
+        return NULL;
+    }
+
+    offset_limit = compress_level(ctx)->zx0_max_offset;
+    ctx->zx0.memory_limit = ctx->options->mem_limit;
+
+    for (;;)
+    {
+        if (ctx->options->fast)
+        {
+            optimal = zx0_optimize_fast(&ctx->zx0, data, (int)size, (int)skip, offset_limit);
+        }
+        else
+        {
+            if (ctx->progress)
+            {
+                LOG_PRINT("[info] Compressing [");
+            }
+
+            optimal = zx0_optimize(&ctx->zx0, &ctx->matches, (int)skip, offset_limit,
+                                   ctx->progress ? compress_zx0_progress : NULL);
+
+            if (ctx->progress)
+            {
+                LOG_PRINT("]\n");
+            }
+        }
+
+        if (optimal != NULL || !ctx->zx0.limit_reached)
+        {
+            break;
+        }
+
+        /* over the memory limit, trade ratio for the next smaller level's window */
+        for (level = COMPRESS_LEVEL_MAX - 1; level >= 0; --level)
+        {
+            if (compress_levels[level].zx0_max_offset < offset_limit)
+            {
+                break;
+            }
+        }
+
+        if (level < 0)
+        {
+            break;
+        }
+
+        offset_limit = compress_levels[level].zx0_max_offset;
+        LOG_INFO("Memory limit reached, retrying with a %d byte window.\n", offset_limit);
+    }
+
+    if (optimal == NULL)
+    {
+        if (ctx->zx0.limit_reached)
+        {
+            LOG_ERROR("Compression needs more than the memory limit (%lu KiB).\n",
+                (unsigned long)(ctx->options->mem_limit / 1024));
+        }
+        else
+        {
+            LOG_ERROR("Out of memory.\n");
+        }
+        return NULL;
+    }
+
+    LOG_DEBUG("zx0 optimizer peak memory: %lu KiB (window %d).\n",
+        (unsigned long)(ctx->zx0.memory / 1024), offset_limit);
+
+    return optimal;
+}
+
+static int compress_zx0(struct compress_ctx *ctx,
+                        const uint8_t *data,
+                        size_t size,
+                        size_t skip,
+                        uint8_t **zx0_data,
+                        size_t *zx0_size,
+                        int32_t *delta)
+{
+    struct zx0_block *optimal;
+    uint8_t *compressed_data;
+    int new_size;
+    int new_delta;
+
+    if (ctx == NULL || zx0_data == NULL || delta == NULL)
+    {
+        return -1;
+    }
+
+    optimal = compress_zx0_optimize(ctx, data, size, skip);
+    if (optimal == NULL)
+    {
+        return -1;
+    }
+
+    compressed_data = zx0_compress(optimal, data, (int)size,
+                                   (int)skip, 0, 1, &new_size, &new_delta);
+    if (compressed_data == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    *zx0_data = compressed_data;
+    *zx0_size = new_size;
+    *delta = new_delta;
+
+    return 0;
+}
+
+void compress_ctx_init(struct compress_ctx *ctx, const struct compress_options *options)
+{
+    ctx->options = options != NULL ? options : &compress_default_options;
+    ctx->verify = NULL;
+    match_index_init(&ctx->matches);
+    zx0_ctx_init(&ctx->zx0);
+    zx7_ctx_init(&ctx->zx7);
+    ctx->prefix = NULL;
+    ctx->prefix_size = 0;
+    ctx->checkpoint = NULL;
+    ctx->nr_threads = thread_cpu_count();
+    ctx->progress = true;
+}
+
+void compress_ctx_free(struct compress_ctx *ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+
+    match_index_free(&ctx->matches);
+    zx0_ctx_free(&ctx->zx0);
+    zx7_ctx_free(&ctx->zx7);
+}
+
+struct compress_zx7_job
+{
+    struct compress_ctx *ctx;
+    const uint8_t *data;
+    size_t size;
+    size_t skip;
+    uint8_t *out_data;
+    size_t out_size;
+    int32_t delta;
+    int ret;
+};
+
+static void compress_zx7_job_run(void *arg)
+{
+    struct compress_zx7_job *job = arg;
+
+    job->ret = compress_zx7(job->ctx, job->data, job->size, job->skip,
+        &job->out_data, &job->out_size, &job->delta);
+}
+
+struct compress_candidate
+{
+    compress_mode_t mode;
+    size_t size;
+    unsigned long cycles;
+};
+
+static const char *compress_mode_name(compress_mode_t mode)
+{
+    return mode == COMPRESS_ZX0 ? "zx0" : "zx7";
+}
+
+static size_t compress_footprint(const struct compress_candidate *candidate)
+{
+    return candidate->size + (candidate->mode == COMPRESS_ZX0 ?
+        zx0_decompressor_len : zx7_decompressor_len);
+}
+
+/*
+ * Picks between the zx7 and zx0 results of auto mode according to the
+ * compression goal: the smallest stream, the fewest estimated eZ80 cycles to
+ * decompress, or the smallest stream plus decompressor. Ties go to the
+ * smaller stream, then to zx7. Returns the index of the chosen candidate.
+ */
+static int compress_choose(const struct compress_options *options,
+                           const struct compress_candidate candidates[2])
+{
+    const struct compress_candidate *zx7 = &candidates[0];
+    const struct compress_candidate *zx0 = &candidates[1];
+    static const char *goals[] =
+    {
+        "smallest size",
+        "fastest decompression",
+        "smallest footprint",
+    };
+    int i;
+    int chosen;
+
+    switch (options->goal)
+    {
+        case COMPRESS_GOAL_SPEED:
+            chosen = zx0->cycles < zx7->cycles ||
+                (zx0->cycles == zx7->cycles && zx0->size < zx7->size);
+            break;
+
+        case COMPRESS_GOAL_FOOTPRINT:
+            chosen = compress_footprint(zx0) < compress_footprint(zx7) ||
+                (compress_footprint(zx0) == compress_footprint(zx7) && zx0->size < zx7->size);
+            break;
+
+        default:
+            chosen = zx0->size < zx7->size;
+            break;
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+        LOG_INFO("%s: %lu bytes, %lu with decompressor, ~%lu cycles to decompress.\n",
+            compress_mode_name(candidates[i].mode),
+            (unsigned long)candidates[i].size,
+            (unsigned long)compress_footprint(&candidates[i]),
+            candidates[i].cycles);
+    }
+
+    LOG_INFO("Chose %s for %s.\n",
+        compress_mode_name(candidates[chosen].mode), goals[options->goal]);
+
+    return chosen;
+}
+
+/*
+ * Compresses data[skip..size). The first skip bytes are a prefix window that
+ * matches may refer back into but which is not part of the output.
+ */
+static int compress_array_run(struct compress_ctx *ctx,
+                              const uint8_t *data,
+                              size_t size,
+                              size_t skip,
+                              uint8_t **out_data,
+                              size_t *out_size,
+                              int32_t *delta,
+                              compress_mode_t *mode)
+{
+    int ret = 0;
+
+    if (ctx == NULL || data == NULL || out_data == NULL || out_size == NULL || delta == NULL || mode == NULL)
+    {
+        return -1;
+    }
+
+    *out_data = NULL;
+    *out_size = size - skip;
+
+    if (*mode == COMPRESS_NONE)
+    {
+        *delta = 0;
+        return 0;
+    }
+
+    /* only the optimal zx0 parser reads the match index */
+    if (*mode != COMPRESS_ZX7 && !ctx->options->fast &&
+        match_index_build(&ctx->matches, data, size) != 0)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    switch (*mode)
+    {
+        case COMPRESS_ZX7:
+            ret = compress_zx7(ctx, data, size, skip, out_data, out_size, delta);
+            break;
+
+        case COMPRESS_ZX0:
+            ret = compress_zx0(ctx, data, size, skip, out_data, out_size, delta);
+            break;
+
+        case COMPRESS_AUTO:
+        {
+            struct compress_candidate candidates[2];
+            struct compress_zx7_job zx7_job;
+            struct thread zx7_thread;
+            bool zx7_threaded;
+            uint8_t *zx0_data = NULL;
+            size_t zx0_size = 0;
+            int32_t zx0_delta = 0;
+
+            zx7_job.ctx = ctx;
+            zx7_job.data = data;
+            zx7_job.size = size;
+            zx7_job.skip = skip;
+            zx7_job.out_data = NULL;
+            zx7_job.out_size = 0;
+            zx7_job.delta = 0;
+            zx7_job.ret = -1;
+
+            /* the codecs share only the read-only match index, so run zx7 alongside zx0 */
+            zx7_threaded = thread_start(&zx7_thread, compress_zx7_job_run, &zx7_job) == 0;
+            if (!zx7_threaded)
+            {
+                compress_zx7_job_run(&zx7_job);
+            }
+
+            ret = compress_zx0(ctx, data, size, skip, &zx0_data, &zx0_size, &zx0_delta);
+
+            if (zx7_threaded && thread_join(&zx7_thread) != 0)
+            {
+                LOG_ERROR("Could not join compression thread.\n");
+                zx7_job.ret = -1;
+            }
+
+            if (ret || zx7_job.ret)
+            {
+                free(zx7_job.out_data);
+                free(zx0_data);
+                return -1;
+            }
+
+            candidates[0].mode = COMPRESS_ZX7;
+            candidates[0].size = zx7_job.out_size;
+            candidates[1].mode = COMPRESS_ZX0;
+            candidates[1].size = zx0_size;
+
+            if (decompress_estimate_cycles(data, skip, zx7_job.out_data, zx7_job.out_size,
+                    COMPRESS_ZX7, &candidates[0].cycles) != 0 ||
+                decompress_estimate_cycles(data, skip, zx0_data, zx0_size,
+                    COMPRESS_ZX0, &candidates[1].cycles) != 0)
+            {
+                LOG_ERROR("Could not estimate decompression time.\n");
+                free(zx7_job.out_data);
+                free(zx0_data);
+                return -1;
+            }
+
+            if (compress_choose(ctx->options, candidates) == 0)
+            {
+                *out_data = zx7_job.out_data;
+                *out_size = zx7_job.out_size;
+                *delta = zx7_job.delta;
+                *mode = COMPRESS_ZX7;
+                free(zx0_data);
+            }
+            else
+            {
+                *out_data = zx0_data;
+                *out_size = zx0_size;
+                *delta = zx0_delta;
+                *mode = COMPRESS_ZX0;
+                free(zx7_job.out_data);
+            }
+
+            return 0;
+        }
+
+        default:
+            ret = -1;
+            break;
+    }
+
+    return ret;
+}
+
+static void compress_cache_key(const struct compress_ctx *ctx,
+                               const uint8_t *data,
+                               size_t size,
+                               size_t skip,
+                               compress_mode_t mode,
+                               uint8_t key[CACHE_KEY_SIZE])
+{
+    uint8_t params[25];
+
+    /* the goal only changes which codec auto mode keeps */
+    params[0] = (uint8_t)mode | (uint8_t)(ctx->options->goal << 4) | (ctx->options->fast ? 0x80 : 0);
+    compress_wr32(params + 1, compress_level(ctx)->zx0_max_offset);
+    compress_wr32(params + 5, compress_level(ctx)->zx7_max_offset);
+    compress_wr32(params + 9, compress_level(ctx)->zx7_max_length);
+
+    /* the memory limit can shrink the zx0 window */
+    compress_wr32(params + 13, ctx->options->mem_limit & 0xffffffff);
+    compress_wr32(params + 17, (ctx->options->mem_limit >> 16) >> 16);
+
+    /* only keyed when a prefix is used, so other keys stay as they were */
+    compress_wr32(params + 21, skip);
+
+    cache_key(data, size, params, skip != 0 ? sizeof params : sizeof params - 4, key);
+}
+
+/*
+ * Decodes compressed data and checks it against data[skip..size), with the
+ * first skip bytes as the prefix the stream may refer back into.
+ */
+static int compress_verify_check(const uint8_t *data,
+                                 size_t size,
+                                 size_t skip,
+                                 const uint8_t *compressed_data,
+                                 size_t compressed_size,
+                                 compress_mode_t mode)
+{
+    uint8_t *decoded_data;
+    size_t decoded_size;
+    bool match;
+
+    if (decompress_array_prefix(data, skip, compressed_data, compressed_size,
+            mode, &decoded_data, &decoded_size) != 0)
+    {
+        LOG_ERROR("Verification failed: could not decompress %s data.\n",
+            mode == COMPRESS_ZX0 ? "zx0" : "zx7");
+        return -1;
+    }
+
+    match = decoded_size == size - skip && memcmp(decoded_data, data + skip, size - skip) == 0;
+    free(decoded_data);
+
+    if (!match)
+    {
+        LOG_ERROR("Verification failed: %s data does not decompress to the input.\n",
+            mode == COMPRESS_ZX0 ? "zx0" : "zx7");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void compress_verify_run(void *arg)
+{
+    struct compress_verify *verify = arg;
+
+    if (compress_verify_check(verify->data, verify->size, verify->skip,
+            verify->compressed_data, verify->compressed_size, verify->mode) != 0)
+    {
+        verify->ret = -1;
+    }
+
+    free(verify->data);
+    free(verify->compressed_data);
+    verify->data = NULL;
+    verify->compressed_data = NULL;
+}
+
+void compress_verify_init(struct compress_verify *verify)
+{
+    verify->pending = false;
+    verify->data = NULL;
+    verify->compressed_data = NULL;
+    verify->ret = 0;
+}
+
+int compress_verify_wait(struct compress_verify *verify)
+{
+    if (verify->pending)
+    {
+        if (thread_join(&verify->thread) != 0)
+        {
+            LOG_ERROR("Could not join verification thread.\n");
+            verify->ret = -1;
+        }
+        verify->pending = false;
+    }
+
+    return verify->ret;
+}
+
+/*
+ * Hands a result over to the verification thread, after waiting for the
+ * one before it. The data and result are copied, as the caller goes on to
+ * overwrite or free them. Returns nonzero if the check could not be started
+ * or an earlier one failed.
+ */
+static int compress_verify_start(struct compress_verify *verify,
+                                 const uint8_t *data,
+                                 size_t size,
+                                 size_t skip,
+                                 const uint8_t *compressed_data,
+                                 size_t compressed_size,
+                                 compress_mode_t mode)
+{
+    if (compress_verify_wait(verify) != 0)
+    {
+        return -1;
+    }
+
+    verify->data = malloc(size);
+    verify->compressed_data = malloc(compressed_size == 0 ? 1 : compressed_size);
+    if (verify->data == NULL || verify->compressed_data == NULL)
+    {
+        free(verify->data);
+        free(verify->compressed_data);
+        verify->data = NULL;
+        verify->compressed_data = NULL;
+        return 1;
+    }
+
+    memcpy(verify->data, data, size);
+    memcpy(verify->compressed_data, compressed_data, compressed_size);
+    verify->size = size;
+    verify->skip = skip;
+    verify->compressed_size = compressed_size;
+    verify->mode = mode;
+
+    if (thread_start(&verify->thread, compress_verify_run, verify) != 0)
+    {
+        compress_verify_run(verify);
+        return verify->ret;
+    }
+
+    verify->pending = true;
+
+    return 0;
+}
+
+/*
+ * With --verify, decodes a freshly compressed or cached result and checks it
+ * against the source. If the context has a verification thread the check
+ * runs there, and a mismatch is reported by compress_verify_wait().
+ * Otherwise it runs on whichever thread did the compression, so the --jobs
+ * and block workers verify in parallel. A failure frees the result.
+ */
+static int compress_verify_result(const struct compress_ctx *ctx,
+                                  const uint8_t *data,
+                                  size_t size,
+                                  size_t skip,
+                                  uint8_t **out_data,
+                                  size_t out_size,
+                                  compress_mode_t mode)
+{
+    int ret = 1;
+
+    if (!ctx->options->verify || mode == COMPRESS_NONE)
+    {
+        return 0;
+    }
+
+    if (ctx->verify != NULL)
+    {
+        ret = compress_verify_start(ctx->verify, data, size, skip, *out_data, out_size, mode);
+    }
+
+    /* checked inline when there is no thread or it could not be started */
+    if (ret > 0)
+    {
+        ret = compress_verify_check(data, size, skip, *out_data, out_size, mode);
+    }
+
+    if (ret != 0)
+    {
+        free(*out_data);
+        *out_data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * If the context has a prefix, copies the part of it that matches can reach
+ * in front of the data, and points data and size at the copy. skip is set to
+ * the length of that part. The copy is freed by the caller.
+ */
+static int compress_window(const struct compress_ctx *ctx,
+                           const uint8_t **data,
+                           size_t *size,
+                           uint8_t **window,
+                           size_t *skip)
+{
+    *window = NULL;
+    *skip = 0;
+
+    if (ctx == NULL || ctx->prefix_size == 0)
+    {
+        return 0;
+    }
+
+    /* matches cannot reach further back than the largest window */
+    *skip = compress_level(ctx)->zx0_max_offset > compress_level(ctx)->zx7_max_offset ?
+        compress_level(ctx)->zx0_max_offset : compress_level(ctx)->zx7_max_offset;
+    if (*skip > ctx->prefix_size)
+    {
+        *skip = ctx->prefix_size;
+    }
+
+    *window = malloc(*skip + *size);
+    if (*window == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    memcpy(*window, ctx->prefix + ctx->prefix_size - *skip, *skip);
+    memcpy(*window + *skip, *data, *size);
+    *data = *window;
+    *size += *skip;
+
+    return 0;
+}
+
+/*
+ * Compresses data as a single stream into a newly allocated buffer, going
+ * through the cache and --verify.
+ */
+static int compress_array_stream(struct compress_ctx *ctx,
+                                 const uint8_t *data,
+                                 size_t size,
+                                 uint8_t **out_data,
+                                 size_t *out_size,
+                                 int32_t *delta,
+                                 compress_mode_t *mode)
+{
+    uint8_t key[CACHE_KEY_SIZE];
+    uint8_t *window = NULL;
+    size_t skip = 0;
+    bool cached;
+    int ret;
+
+    if (ctx == NULL || data == NULL || mode == NULL)
+    {
+        return -1;
+    }
+
+    if (*mode != COMPRESS_NONE &&
+        compress_window(ctx, &data, &size, &window, &skip) != 0)
+    {
+        return -1;
+    }
+
+    cached = cache_enabled() && *mode != COMPRESS_NONE;
+    if (cached)
+    {
+        compress_cache_key(ctx, data, size, skip, *mode, key);
+
+        if (cache_lookup(key, out_data, out_size, delta, mode) == 0)
+        {
+            ret = compress_verify_result(ctx, data, size, skip, out_data, *out_size, *mode);
+            goto cleanup;
+        }
+    }
+
+    ret = compress_array_run(ctx, data, size, skip, out_data, out_size, delta, mode);
+    if (ret == 0)
+    {
+        ret = compress_verify_result(ctx, data, size, skip, out_data, *out_size, *mode);
+    }
+
+    if (ret == 0 && cached)
+    {
+        cache_store(key, *out_data, *out_size, *delta, *mode);
+    }
+
+cleanup:
+    free(window);
+
+    return ret;
+}
+
+/*
+ * Sizes what compress_array_alloc would produce for each codec from the parse
+ * alone, without writing the streams or using the cache. The sizes are exact
+ * for the parser in use; with --compress-fast they are also an upper bound
+ * for the optimal parse. COMPRESS_AUTO sizes both codecs; a codec that is
+ * not sized is left as 0.
+ */
+int compress_estimate(struct compress_ctx *ctx,
+                      const uint8_t *data,
+                      size_t size,
+                      compress_mode_t mode,
+                      struct compress_sizes *sizes)
+{
+    uint8_t *window = NULL;
+    size_t skip = 0;
+    int ret = -1;
+
+    if (ctx == NULL || data == NULL || sizes == NULL)
+    {
+        return -1;
+    }
+
+    sizes->zx7_size = 0;
+    sizes->zx0_size = 0;
+
+    if (mode == COMPRESS_NONE)
+    {
+        return 0;
+    }
+
+    if (compress_window(ctx, &data, &size, &window, &skip) != 0)
+    {
+        return -1;
+    }
+
+    if (mode != COMPRESS_ZX7 && !ctx->options->fast &&
+        match_index_build(&ctx->matches, data, size) != 0)
+    {
+        LOG_ERROR("Out of memory.\n");
+        goto cleanup;
+    }
+
+    if (mode == COMPRESS_ZX7 || mode == COMPRESS_AUTO)
+    {
+        struct zx7_optimal *opt = compress_zx7_optimize(ctx, data, size, skip, NULL);
+
+        if (opt == NULL)
+        {
+            goto cleanup;
+        }
+
+        sizes->zx7_size = zx7_compressed_size(opt, size);
+        free(opt);
+    }
+
+    if (mode == COMPRESS_ZX0 || mode == COMPRESS_AUTO)
+    {
+        struct zx0_block *optimal = compress_zx0_optimize(ctx, data, size, skip);
+
+        if (optimal == NULL)
+        {
+            goto cleanup;
+        }
+
+        sizes->zx0_size = (size_t)zx0_compressed_size(optimal);
+    }
+
+    ret = 0;
+
+cleanup:
+    free(window);
+
+    return ret;
+}
+
+/*
+ * Spreads the bits of a token over the positions it covers, as if each
+ * byte cost the same.
+ */
+static void compress_prefix_spread(uint32_t *costs, size_t start, size_t end, uint32_t prev, uint32_t bits)
+{
+    size_t i;
+
+    for (i = start; i <= end; ++i)
+    {
+        costs[i] = prev + (uint32_t)((uint64_t)(bits - prev) * (i - start + 1) / (end - start + 1));
+    }
+}
+
+/*
+ * Estimates the bits the codec needs for every prefix of data from one
+ * greedy parse, as used by --compress-fast: costs[i] is the cost of
+ * data[0..i], with the bits of each token spread over its bytes. This is
+ * much quicker than the optimal parse but somewhat above it, so callers
+ * should scale it by sizes from a real compression. mode must be zx7 or
+ * zx0. The costs are freed by the caller.
+ */
+int compress_prefix_costs(struct compress_ctx *ctx,
+                          const uint8_t *data,
+                          size_t size,
+                          compress_mode_t mode,
+                          uint32_t **costs)
+{
+    const struct compress_level *level;
+    uint32_t *table;
+
+    if (ctx == NULL || data == NULL || size == 0 || size > INT32_MAX || costs == NULL ||
+        (mode != COMPRESS_ZX7 && mode != COMPRESS_ZX0))
+    {
+        return -1;
+    }
+
+    level = compress_level(ctx);
+
+    table = malloc(size * sizeof(uint32_t));
+    if (table == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        free(table);
+        return -1;
+    }
+
+    if (mode == COMPRESS_ZX7)
+    {
+        struct zx7_optimal *opt;
+        size_t end = size;
+
+        opt = zx7_optimize_fast(&ctx->zx7, data, size, 0, level->zx7_max_offset,
+                                level->zx7_max_length);
+        if (opt == NULL)
+        {
+            LOG_ERROR("Out of memory.\n");
+            free(table);
+            return -1;
+        }
+
+        /* walk the parse back from the end, a token at a time */
+        while (end > 0)
+        {
+            size_t len = opt[end - 1].len > 0 ? opt[end - 1].len : 1;
+            size_t start = end - len;
+
+            compress_prefix_spread(table, start, end - 1,
+                start > 0 ? opt[start - 1].bits : 0, opt[end - 1].bits);
+            end = start;
+        }
+
+        free(opt);
+    }
+    else
+    {
+        const struct zx0_block *block;
+
+        ctx->zx0.memory_limit = ctx->options->mem_limit;
+
+        block = zx0_optimize_fast(&ctx->zx0, data, (int)size, 0, level->zx0_max_offset);
+        if (block == NULL)
+        {
+            LOG_ERROR("Out of memory.\n");
+            free(table);
+            return -1;
+        }
+
+        /* the chain ends in a block before the first byte */
+        for (; block->chain != NULL; block = block->chain)
+        {
+            const struct zx0_block *prev = block->chain;
+
+            compress_prefix_spread(table, (size_t)(prev->index + 1), (size_t)block->index,
+                prev->bits > 0 ? (uint32_t)prev->bits : 0, (uint32_t)block->bits);
+        }
+    }
+
+    *costs = table;
+
+    return 0;
+}
+
+struct compress_block_pool
+{
+    const struct compress_options *options;
+    struct compress_block *blocks;
+    size_t nr_blocks;
+    struct thread_mutex lock;
+    size_t next;
+    int ret;
+};
+
+static void compress_block_worker(void *arg)
+{
+    struct compress_block_pool *pool = arg;
+    struct compress_ctx ctx;
+
+    compress_ctx_init(&ctx, pool->options);
+    ctx.nr_threads = 1;
+    ctx.progress = false;
+
+    for (;;)
+    {
+        struct compress_block *block = NULL;
+
+        thread_mutex_lock(&pool->lock);
+        if (pool->ret == 0 && pool->next < pool->nr_blocks)
+        {
+            block = &pool->blocks[pool->next++];
+        }
+        thread_mutex_unlock(&pool->lock);
+
+        if (block == NULL)
+        {
+            break;
+        }
+
+        if (compress_array_stream(&ctx, block->data, block->size,
+                &block->out_data, &block->out_size, &block->delta, &block->mode) < 0)
+        {
+            thread_mutex_lock(&pool->lock);
+            pool->ret = -1;
+            thread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    compress_ctx_free(&ctx);
+}
+
+/*
+ * Compresses each block on its own, on up to ctx->nr_threads threads. Every
+ * block uses the same codec; in auto mode each block is tried with both and
+ * the codec is chosen on the totals, by the compression goal. overhead is
+ * the size the caller adds around the blocks, and is only used for logging.
+ * On success every block holds its compressed data, which the caller frees,
+ * and mode is set to the codec used. On failure no compressed data is kept.
+ */
+int compress_blocks(struct compress_ctx *ctx,
+                    struct compress_block *blocks,
+                    size_t nr_blocks,
+                    size_t overhead,
+                    compress_mode_t *mode)
+{
+    struct compress_block_pool pool;
+    struct compress_block *jobs = blocks;
+    struct thread *threads = NULL;
+    unsigned int nr_threads = 0;
+    unsigned int nr_workers;
+    size_t nr_codecs;
+    size_t i;
+    int ret = -1;
+
+    if (ctx == NULL || blocks == NULL || nr_blocks == 0 || mode == NULL)
+    {
+        return -1;
+    }
+
+    nr_codecs = *mode == COMPRESS_AUTO ? 2 : 1;
+
+    if (nr_codecs > 1)
+    {
+        jobs = calloc(nr_blocks * nr_codecs, sizeof(struct compress_block));
+        if (jobs == NULL)
+        {
+            LOG_ERROR("Out of memory.\n");
+            return -1;
+        }
+    }
 
-#include "asm/zx7_decompressor.h"
-#include "asm/zx0_decompressor.h"
+    for (i = 0; i < nr_blocks * nr_codecs; ++i)
+    {
+        struct compress_block *job = &jobs[i];
+
+        job->data = blocks[i % nr_blocks].data;
+        job->size = blocks[i % nr_blocks].size;
+        job->mode = *mode;
+        job->out_data = NULL;
+        job->out_size = 0;
+        job->delta = 0;
+        if (nr_codecs > 1)
+        {
+            job->mode = i < nr_blocks ? COMPRESS_ZX7 : COMPRESS_ZX0;
+        }
+    }
 
-#include <string.h>
-#include <stdlib.h>
+    if (thread_mutex_init(&pool.lock) != 0)
+    {
+        LOG_ERROR("Could not create compression lock.\n");
+        goto cleanup;
+    }
 
-static int compress_zx7(uint8_t *data, size_t size, uint8_t **zx7_data, size_t *zx7_size, int32_t *delta)
-{
-    zx7_Optimal *opt;
-    uint8_t *compressed_data;
-    size_t new_size;
-    long new_delta;
+    pool.options = ctx->options;
+    pool.blocks = jobs;
+    pool.nr_blocks = nr_blocks * nr_codecs;
+    pool.next = 0;
+    pool.ret = 0;
 
-    if (data == NULL || zx7_data == NULL)
+    nr_workers = ctx->nr_threads > 0 ? ctx->nr_threads : 1;
+    if (nr_workers > pool.nr_blocks)
     {
-        return -1;
+        nr_workers = (unsigned int)pool.nr_blocks;
     }
 
-    opt = zx7_optimize(data, size, 0);
-    if (opt == NULL)
+    LOG_INFO("Compressing %lu blocks on %u threads...\n",
+        (unsigned long)nr_blocks, nr_workers);
+
+    if (nr_workers > 1)
     {
-        LOG_ERROR("Could not optimize zx7.\n");
-        return -1;
+        threads = malloc((nr_workers - 1) * sizeof(struct thread));
     }
 
-    compressed_data = zx7_compress(opt, data, size, 0, &new_size, &new_delta);
-    free(opt);
-    if (compressed_data == NULL)
+    /* the calling thread is one of the workers */
+    while (threads != NULL && nr_threads < nr_workers - 1)
     {
-        LOG_ERROR("Out of memory.\n");
-        return -1;
+        if (thread_start(&threads[nr_threads], compress_block_worker, &pool) != 0)
+        {
+            break;
+        }
+        nr_threads++;
     }
 
-    *zx7_data = compressed_data;
-    *zx7_size = new_size;
-    *delta = new_delta;
+    compress_block_worker(&pool);
 
-    return 0;
-}
+    for (i = 0; i < nr_threads; ++i)
+    {
+        if (thread_join(&threads[i]) != 0)
+        {
+            LOG_ERROR("Could not join compression thread.\n");
+            pool.ret = -1;
+        }
+    }
 
-static void compress_zx0_progress(void)
-{
-    LOG_PRINT(".");
+    thread_mutex_destroy(&pool.lock);
+
+    if (pool.ret != 0)
+    {
+        goto cleanup;
+    }
+
+    if (nr_codecs > 1)
+    {
+        struct compress_candidate candidates[2];
+        struct compress_block *chosen;
+
+        candidates[0].mode = COMPRESS_ZX7;
+        candidates[1].mode = COMPRESS_ZX0;
+
+        for (i = 0; i < 2; ++i)
+        {
+            candidates[i].size = overhead;
+            candidates[i].cycles = 0;
+        }
+
+        for (i = 0; i < nr_blocks * nr_codecs; ++i)
+        {
+            struct compress_candidate *candidate = &candidates[i / nr_blocks];
+            unsigned long cycles;
+
+            if (decompress_estimate_cycles(NULL, 0, jobs[i].out_data, jobs[i].out_size,
+                    jobs[i].mode, &cycles) != 0)
+            {
+                LOG_ERROR("Could not estimate decompression time.\n");
+                goto cleanup;
+            }
+
+            candidate->size += jobs[i].out_size;
+            candidate->cycles += cycles;
+        }
+
+        chosen = &jobs[compress_choose(ctx->options, candidates) * nr_blocks];
+
+        /* hand the chosen results over to the caller */
+        for (i = 0; i < nr_blocks; ++i)
+        {
+            blocks[i] = chosen[i];
+            chosen[i].out_data = NULL;
+        }
+    }
+
+    *mode = blocks[0].mode;
+    ret = 0;
+
+cleanup:
+    if (jobs != blocks)
+    {
+        for (i = 0; i < nr_blocks * nr_codecs; ++i)
+        {
+            free(jobs[i].out_data);
+        }
+        free(jobs);
+    }
+    else if (ret != 0)
+    {
+        for (i = 0; i < nr_blocks; ++i)
+        {
+            free(blocks[i].out_data);
+            blocks[i].out_data = NULL;
+        }
+    }
+    free(threads);
+
+    return ret;
 }
 
-static int compress_zx0(uint8_t *data, size_t size, uint8_t **zx0_data, size_t *zx0_size, int32_t *delta)
+/*
+ * Splits the data into independent blocks of the context's block size and
+ * compresses them with compress_blocks. The output starts with a table of
+ * 24-bit little endian values: the number of blocks, then for each block its
+ * uncompressed and compressed size. The compressed blocks follow in order.
+ */
+static int compress_array_blocks(struct compress_ctx *ctx,
+                                 const uint8_t *data,
+                                 size_t size,
+                                 uint8_t **out_data,
+                                 size_t *out_size,
+                                 int32_t *delta,
+                                 compress_mode_t *mode)
 {
-    zx0_BLOCK *optimal;
-    uint8_t *compressed_data;
-    int new_size;
-    int new_delta;
+    struct compress_block *blocks = NULL;
+    size_t block_size = ctx->options->block_size;
+    uint8_t *table;
+    size_t nr_blocks;
+    size_t total;
+    size_t pos;
+    size_t i;
+    int ret = -1;
+
+    nr_blocks = (size + block_size - 1) / block_size;
+    if (nr_blocks == 0 || nr_blocks > COMPRESS_BLOCK_SIZE_MAX)
+    {
+        LOG_ERROR("Cannot split %lu bytes into compression blocks.\n",
+            (unsigned long)size);
+        return -1;
+    }
 
-    if (data == NULL || zx0_data == NULL || delta == NULL)
+    blocks = calloc(nr_blocks, sizeof(struct compress_block));
+    if (blocks == NULL)
     {
+        LOG_ERROR("Out of memory.\n");
         return -1;
     }
 
-    LOG_PRINT("[info] Compressing [");
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        size_t offset = i * block_size;
 
-    optimal = zx0_optimize(data, size, 0, ZX0_MAX_OFFSET, compress_zx0_progress);
-    if (optimal == NULL)
+        blocks[i].data = data + offset;
+        blocks[i].size = size - offset < block_size ?
+            size - offset : block_size;
+    }
+
+    total = COMPRESS_BLOCK_COUNT_LEN + nr_blocks * COMPRESS_BLOCK_ENTRY_LEN;
+
+    if (compress_blocks(ctx, blocks, nr_blocks, total, mode) != 0)
     {
-        LOG_ERROR("Out of memory]\n");
-        zx0_free();
+        free(blocks);
         return -1;
     }
 
-    compressed_data = zx0_compress(optimal, data, size, 0, 0, 1, &new_size, &new_delta);
-
-    LOG_PRINT("]\n");
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        total += blocks[i].out_size;
+    }
 
-    if (compressed_data == NULL)
+    table = malloc(total);
+    if (table == NULL)
     {
         LOG_ERROR("Out of memory.\n");
-        zx0_free();
-        return -1;
+        goto cleanup;
     }
 
-    *zx0_data = compressed_data;
-    *zx0_size = new_size;
-    *delta = new_delta;
+    compress_wr24(table, (uint32_t)nr_blocks);
+    pos = COMPRESS_BLOCK_COUNT_LEN + nr_blocks * COMPRESS_BLOCK_ENTRY_LEN;
+    *delta = 0;
+
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        uint8_t *entry = table + COMPRESS_BLOCK_COUNT_LEN + i * COMPRESS_BLOCK_ENTRY_LEN;
 
-    zx0_free();
+        compress_wr24(entry + 0, (uint32_t)blocks[i].size);
+        compress_wr24(entry + 3, (uint32_t)blocks[i].out_size);
+        memcpy(table + pos, blocks[i].out_data, blocks[i].out_size);
+        pos += blocks[i].out_size;
 
-    return 0;
+        if (blocks[i].delta > *delta)
+        {
+            *delta = blocks[i].delta;
+        }
+    }
+
+    *out_data = table;
+    *out_size = total;
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        free(blocks[i].out_data);
+    }
+    free(blocks);
+
+    return ret;
 }
 
-static int compress_array_alloc(const uint8_t *data,
-                                size_t size,
-                                uint8_t **out_data,
-                                size_t *out_size,
-                                int32_t *delta,
-                                compress_mode_t *mode)
+/*
+ * Compresses data out of place into a newly allocated buffer, as independent
+ * blocks if the context has a block size. The result may be larger than the
+ * input. out_data is left NULL if mode is COMPRESS_NONE.
+ */
+int compress_array_alloc(struct compress_ctx *ctx,
+                         const uint8_t *data,
+                         size_t size,
+                         uint8_t **out_data,
+                         size_t *out_size,
+                         int32_t *delta,
+                         compress_mode_t *mode)
 {
-    int ret = 0;
-
-    if (data == NULL || out_data == NULL || out_size == NULL || delta == NULL || mode == NULL)
+    if (ctx == NULL || data == NULL || out_data == NULL || out_size == NULL ||
+        delta == NULL || mode == NULL)
     {
         return -1;
     }
 
     *out_data = NULL;
-    *out_size = size;
 
-    switch (*mode)
+    if (ctx->options->block_size != 0 && *mode != COMPRESS_NONE)
     {
-        case COMPRESS_NONE:
-            *delta = 0;
-            return 0;
-
-        case COMPRESS_ZX7:
-            ret = compress_zx7((uint8_t *)data, size, out_data, out_size, delta);
-            break;
-
-        case COMPRESS_ZX0:
-            ret = compress_zx0((uint8_t *)data, size, out_data, out_size, delta);
-            break;
-
-        case COMPRESS_AUTO:
-        {
-            uint8_t *zx7_data = NULL;
-            size_t zx7_size = 0;
-            int32_t zx7_delta = 0;
-            uint8_t *zx0_data = NULL;
-            size_t zx0_size = 0;
-            int32_t zx0_delta = 0;
+        return compress_array_blocks(ctx, data, size, out_data, out_size, delta, mode);
+    }
 
-            ret = compress_zx7((uint8_t *)data, size, &zx7_data, &zx7_size, &zx7_delta);
-            if (ret)
-            {
-                return -1;
-            }
+    return compress_array_stream(ctx, data, size, out_data, out_size, delta, mode);
+}
 
-            ret = compress_zx0((uint8_t *)data, size, &zx0_data, &zx0_size, &zx0_delta);
-            if (ret)
-            {
-                free(zx7_data);
-                return -1;
-            }
+/*
+ * The most compress_array_alloc can write for size bytes. A parse never
+ * spends more than 10 bits on a byte, a single literal between matches being
+ * the worst case, plus a few bytes of end marker per stream; block mode adds
+ * its table and a stream per block.
+ */
+size_t compress_bound(const struct compress_options *options, size_t size)
+{
+    size_t nr_streams = 1;
+    size_t overhead = 0;
 
-            if (zx7_size <= zx0_size)
-            {
-                *out_data = zx7_data;
-                *out_size = zx7_size;
-                *delta = zx7_delta;
-                *mode = COMPRESS_ZX7;
-                free(zx0_data);
-            }
-            else
-            {
-                *out_data = zx0_data;
-                *out_size = zx0_size;
-                *delta = zx0_delta;
-                *mode = COMPRESS_ZX0;
-                free(zx7_data);
-            }
+    if (options == NULL)
+    {
+        options = &compress_default_options;
+    }
 
-            return 0;
-        }
+    /* each byte costs at most 1 + 1/4 bytes, or a block entry and stream */
+    if (size > ((size_t)-1 - COMPRESS_BOUND_STREAM) / (2 + COMPRESS_BLOCK_ENTRY_LEN + COMPRESS_BOUND_STREAM))
+    {
+        return (size_t)-1;
+    }
 
-        default:
-            ret = -1;
-            break;
+    if (options->block_size != 0)
+    {
+        nr_streams = (size + options->block_size - 1) / options->block_size;
+        overhead = COMPRESS_BLOCK_COUNT_LEN + nr_streams * COMPRESS_BLOCK_ENTRY_LEN;
     }
 
-    return ret;
+    return size + size / 4 + overhead + nr_streams * COMPRESS_BOUND_STREAM;
 }
 
-int compress_array(uint8_t *data, size_t *size, int32_t *delta, compress_mode_t *mode)
+/*
+ * Compresses data in place. The buffer holds capacity bytes, so the result
+ * may be larger than the input as long as it fits.
+ */
+int compress_array(struct compress_ctx *ctx,
+                   uint8_t *data,
+                   size_t *size,
+                   size_t capacity,
+                   int32_t *delta,
+                   compress_mode_t *mode)
 {
     uint8_t *compressed_data = NULL;
     size_t compressed_size = 0;
     int ret = 0;
 
-    if (data == NULL || size == NULL || delta == NULL || mode == NULL)
+    if (ctx == NULL || data == NULL || size == NULL || delta == NULL || mode == NULL)
     {
         return -1;
     }
 
-    ret = compress_array_alloc(data, *size, &compressed_data, &compressed_size, delta, mode);
+    ret = compress_array_alloc(ctx, data, *size, &compressed_data, &compressed_size, delta, mode);
     if (ret != 0)
     {
         return -1;
@@ -231,6 +1702,13 @@ int compress_array(uint8_t *data, size_t *size, int32_t *delta, compress_mode_t
         return -1;
     }
 
+    if (compressed_size > capacity)
+    {
+        LOG_ERROR("Input too large.\n");
+        free(compressed_data);
+        return -1;
+    }
+
     memcpy(data, compressed_data, compressed_size);
     *size = compressed_size;
 
@@ -239,22 +1717,156 @@ int compress_array(uint8_t *data, size_t *size, int32_t *delta, compress_mode_t
     return 0;
 }
 
-static void compress_wr24(uint8_t *addr, uint32_t value)
+static double compress_entropy(const uint8_t *data, size_t size)
 {
-    addr[0] = (value >> 0) & 0xff;
-    addr[1] = (value >> 8) & 0xff;
-    addr[2] = (value >> 16) & 0xff;
+    size_t counts[256];
+    double entropy = 0;
+    size_t i;
+
+    memset(counts, 0, sizeof counts);
+
+    for (i = 0; i < size; ++i)
+    {
+        counts[data[i]]++;
+    }
+
+    for (i = 0; i < 256; ++i)
+    {
+        if (counts[i] != 0)
+        {
+            double p = (double)counts[i] / size;
+
+            entropy -= p * log(p);
+        }
+    }
+
+    return entropy / log(2);
 }
 
-static void compress_wr32(uint8_t *addr, uint32_t value)
+/*
+ * Probes a sample of positions for a match within the window, using only the
+ * most recent earlier occurrence of each hashed prefix. Returns an estimate
+ * of how many bytes of the input could be covered by matches.
+ */
+static size_t compress_probe_matches(const uint8_t *data, size_t size, size_t window)
 {
-    addr[0] = (value >> 0) & 0xff;
-    addr[1] = (value >> 8) & 0xff;
-    addr[2] = (value >> 16) & 0xff;
-    addr[3] = (value >> 24) & 0xff;
+    size_t *head;
+    size_t stride;
+    size_t nr_samples = 0;
+    size_t nr_matched = 0;
+    size_t i;
+
+    if (size < COMPRESS_PROBE_MIN_MATCH)
+    {
+        return 0;
+    }
+
+    head = calloc((size_t)1 << COMPRESS_PROBE_HASH_BITS, sizeof(size_t));
+    if (head == NULL)
+    {
+        return size;
+    }
+
+    stride = size / COMPRESS_PROBE_SAMPLES + 1;
+
+    for (i = 0; i + COMPRESS_PROBE_MIN_MATCH <= size; ++i)
+    {
+        uint32_t hash = ((uint32_t)data[i + 0] << 24) |
+                        ((uint32_t)data[i + 1] << 16) |
+                        ((uint32_t)data[i + 2] << 8) |
+                        ((uint32_t)data[i + 3] << 0);
+
+        hash = (hash * 2654435761u) >> (32 - COMPRESS_PROBE_HASH_BITS);
+        hash &= ((uint32_t)1 << COMPRESS_PROBE_HASH_BITS) - 1;
+
+        if (i % stride == 0)
+        {
+            size_t match = head[hash];
+
+            nr_samples++;
+
+            if (match != 0 && i - (match - 1) <= window &&
+                memcmp(data + match - 1, data + i, COMPRESS_PROBE_MIN_MATCH) == 0)
+            {
+                nr_matched++;
+            }
+        }
+
+        head[hash] = i + 1;
+    }
+
+    free(head);
+
+    return nr_samples == 0 ? 0 : (size_t)((double)nr_matched / nr_samples * size);
+}
+
+/*
+ * Cheap pre-pass for compressed programs: predicts when no codec can save
+ * more than the size of its decompressor, so the optimizers can be skipped.
+ */
+static bool compress_8xp_predict_no_gain(const struct compress_ctx *ctx,
+                                        const uint8_t *data,
+                                        size_t size,
+                                        compress_mode_t mode)
+{
+    size_t decompressor_len;
+    size_t window;
+    size_t matched;
+    double entropy;
+
+    switch (mode)
+    {
+        case COMPRESS_ZX7:
+            decompressor_len = zx7_decompressor_len;
+            window = compress_level(ctx)->zx7_max_offset;
+            break;
+
+        case COMPRESS_ZX0:
+            decompressor_len = zx0_decompressor_len;
+            window = compress_level(ctx)->zx0_max_offset;
+            break;
+
+        case COMPRESS_AUTO:
+            decompressor_len = zx7_decompressor_len < zx0_decompressor_len ?
+                zx7_decompressor_len : zx0_decompressor_len;
+            window = compress_level(ctx)->zx0_max_offset > compress_level(ctx)->zx7_max_offset ?
+                compress_level(ctx)->zx0_max_offset : compress_level(ctx)->zx7_max_offset;
+            break;
+
+        default:
+            return false;
+    }
+
+    entropy = compress_entropy(data, size);
+    if (entropy < COMPRESS_ENTROPY_LIMIT)
+    {
+        return false;
+    }
+
+    matched = compress_probe_matches(data, size, window);
+    if (matched > decompressor_len)
+    {
+        return false;
+    }
+
+    LOG_INFO("Skipping compression, data looks incompressible "
+        "(%.2f bits/byte, ~%lu bytes in matches). Use --compress-force to override.\n",
+        entropy, (unsigned long)matched);
+
+    return true;
 }
 
-int compress_8xp(uint8_t *data, size_t *size, compress_mode_t mode)
+/*
+ * The compressed program is laid out as header, decompressor, then data. On
+ * launch the decompressor inserts memory right after the header, which moves
+ * itself and the data up, then decompresses forwards from the data down to
+ * the header. Forward in-place decompression needs the data to end at least
+ * delta bytes past the output, which this layout gives with a single
+ * InsertMem. A backwards stream would need the data to start delta bytes
+ * before the output instead, and the output has to start right at the
+ * header, so it would only add a move of the data and is not offered.
+ */
+int compress_8xp(struct compress_ctx *ctx, uint8_t *data, size_t *size, compress_mode_t mode)
 {
     size_t uncompressed_size;
     size_t compressed_size;
@@ -263,7 +1875,7 @@ int compress_8xp(uint8_t *data, size_t *size, compress_mode_t mode)
     int ret;
     uint8_t *compressed_data = NULL;
 
-    if (data == NULL || size == NULL)
+    if (ctx == NULL || data == NULL || size == NULL)
     {
         return -1;
     }
@@ -275,12 +1887,18 @@ int compress_8xp(uint8_t *data, size_t *size, compress_mode_t mode)
 
     offset = TI8X_ASMCOMP_LEN;
 
+    if (*size <= offset)
+    {
+        goto odd_8x;
+    }
+
     /* handle icon and/or description to locate the data offset */
     if (data[TI8X_MAGIC_JUMP_OFFSET_0] == TI8X_MAGIC_JUMP)
     {
         offset = TI8X_MAGIC_JUMP_OFFSET_0 + 4;
     }
-    else if (data[TI8X_MAGIC_JUMP_OFFSET_1] == TI8X_MAGIC_JUMP)
+    else if (*size > TI8X_MAGIC_JUMP_OFFSET_1 &&
+             data[TI8X_MAGIC_JUMP_OFFSET_1] == TI8X_MAGIC_JUMP)
     {
         offset = TI8X_MAGIC_JUMP_OFFSET_1 + 4;
     }
@@ -290,10 +1908,23 @@ int compress_8xp(uint8_t *data, size_t *size, compress_mode_t mode)
         goto prepend_marker_only;
     }
 
+    if (*size <= offset)
+    {
+        goto odd_8x;
+    }
+
     if (data[offset] == TI8X_ICON_MAGIC)
     {
-        uint32_t width = data[offset + 1];
-        uint32_t height = data[offset + 2];
+        uint32_t width;
+        uint32_t height;
+
+        if (*size <= offset + 2)
+        {
+            goto odd_8x;
+        }
+
+        width = data[offset + 1];
+        height = data[offset + 2];
 
         offset += 2 + width * height;
         goto move_to_end_of_description;
@@ -302,6 +1933,10 @@ int compress_8xp(uint8_t *data, size_t *size, compress_mode_t mode)
     {
 move_to_end_of_description:
         offset += 1;
+        if (offset >= *size)
+        {
+            goto odd_8x;
+        }
         while (data[offset])
         {
             offset++;
@@ -321,8 +1956,20 @@ odd_8x:
 
     }
 
+    if (*size <= offset)
+    {
+        goto odd_8x;
+    }
+
     uncompressed_size = *size - offset;
-    ret = compress_array_alloc(data + offset, uncompressed_size,
+
+    if (!ctx->options->force &&
+        compress_8xp_predict_no_gain(ctx, data + offset, uncompressed_size, mode))
+    {
+        return 1;
+    }
+
+    ret = compress_array_stream(ctx, data + offset, uncompressed_size,
                                &compressed_data, &compressed_size, &delta, &mode);
     if (ret < 0)
     {
@@ -31,9 +31,16 @@
 #ifndef COMPRESS_H
 #define COMPRESS_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "match.h"
+#include "thread.h"
+#include "ti8x.h"
+#include "zx0.h"
+#include "zx7.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,9 +54,164 @@ typedef enum
     COMPRESS_INVALID,
 } compress_mode_t;
 
-int compress_array(uint8_t *data, size_t *size, int32_t *delta, compress_mode_t *mode);
+typedef enum
+{
+    COMPRESS_GOAL_SIZE,
+    COMPRESS_GOAL_SPEED,
+    COMPRESS_GOAL_FOOTPRINT,
+    COMPRESS_GOAL_INVALID,
+} compress_goal_t;
+
+#define COMPRESS_LEVEL_MIN 1
+#define COMPRESS_LEVEL_MAX 5
+#define COMPRESS_LEVEL_DEFAULT COMPRESS_LEVEL_MAX
+
+#define COMPRESS_BLOCK_SIZE_DEFAULT TI8X_MAXDATA_SIZE
+#define COMPRESS_BLOCK_SIZE_MAX 0xffffff
+#define COMPRESS_BLOCK_COUNT_LEN 3
+#define COMPRESS_BLOCK_ENTRY_LEN 6
+#define COMPRESS_BOUND_STREAM 16
+
+/*
+ * Settings to compress with. level is one of COMPRESS_LEVEL_MIN to
+ * COMPRESS_LEVEL_MAX; a mem_limit of 0 is unlimited; a block_size of 0
+ * compresses the data whole. force skips the incompressible data check for
+ * programs, and verify decodes every result and checks it against the input.
+ */
+struct compress_options
+{
+    int level;
+    size_t mem_limit;
+    size_t block_size;
+    compress_goal_t goal;
+    bool force;
+    bool verify;
+    bool fast;
+};
+
+/*
+ * Checks compressed results on a thread of their own. A context pointing at
+ * one hands each result over with --verify and carries on, such as with the
+ * next input or writing the output; each result waits for the one before.
+ * compress_verify_wait() joins the thread and returns nonzero if any check
+ * failed, and must be called before the results are relied on.
+ */
+struct compress_verify
+{
+    struct thread thread;
+    bool pending;
+    uint8_t *data;
+    size_t size;
+    size_t skip;
+    uint8_t *compressed_data;
+    size_t compressed_size;
+    compress_mode_t mode;
+    int ret;
+};
+
+/*
+ * Per-caller compression state. options points at the settings to use, which
+ * are only read and may be shared by contexts on any thread; they must
+ * outlive the context, and NULL uses the defaults. Contexts themselves are
+ * not shared between threads, so each thread compressing concurrently needs
+ * its own; reusing one context across calls keeps its scratch memory
+ * allocated. Progress output is on by default and should be turned off for
+ * contexts used on worker threads.
+ * The match index is built once per buffer and read by every codec tried
+ * that needs it; the optimal zx7 parser keeps its own window-sized tables.
+ * nr_threads bounds the threads used for block compression; it defaults to
+ * the number of cores and should be 1 for contexts on worker threads.
+ * When prefix_size is set, the prefix bytes are taken to directly precede
+ * the data, and matches may refer back into them; see README.md for the
+ * decompression contract. Block compression ignores the prefix.
+ * verify, if set, takes over --verify checks from the calling thread.
+ * checkpoint names the data across runs, such as by its output file; when
+ * set and the cache is enabled, zx7 parses are saved under it and resumed
+ * from the first changed byte the next time.
+ */
+struct compress_ctx
+{
+    const struct compress_options *options;
+    struct compress_verify *verify;
+    struct match_index matches;
+    struct zx0_ctx zx0;
+    struct zx7_ctx zx7;
+    const uint8_t *prefix;
+    size_t prefix_size;
+    const char *checkpoint;
+    unsigned int nr_threads;
+    bool progress;
+};
+
+/*
+ * One independently compressed block for compress_blocks. The caller sets
+ * data and size; the rest is filled in.
+ */
+struct compress_block
+{
+    const uint8_t *data;
+    size_t size;
+    compress_mode_t mode;
+    uint8_t *out_data;
+    size_t out_size;
+    int32_t delta;
+};
+
+/*
+ * Compressed sizes per codec from compress_estimate, 0 if not estimated.
+ */
+struct compress_sizes
+{
+    size_t zx7_size;
+    size_t zx0_size;
+};
+
+void compress_options_init(struct compress_options *options);
+
+void compress_ctx_init(struct compress_ctx *ctx, const struct compress_options *options);
+
+void compress_ctx_free(struct compress_ctx *ctx);
+
+void compress_verify_init(struct compress_verify *verify);
+
+int compress_verify_wait(struct compress_verify *verify);
+
+int compress_array(struct compress_ctx *ctx,
+                   uint8_t *data,
+                   size_t *size,
+                   size_t capacity,
+                   int32_t *delta,
+                   compress_mode_t *mode);
+
+size_t compress_bound(const struct compress_options *options, size_t size);
+
+int compress_array_alloc(struct compress_ctx *ctx,
+                         const uint8_t *data,
+                         size_t size,
+                         uint8_t **out_data,
+                         size_t *out_size,
+                         int32_t *delta,
+                         compress_mode_t *mode);
+
+int compress_estimate(struct compress_ctx *ctx,
+                      const uint8_t *data,
+                      size_t size,
+                      compress_mode_t mode,
+                      struct compress_sizes *sizes);
+
+int compress_prefix_costs(struct compress_ctx *ctx,
+                          const uint8_t *data,
+                          size_t size,
+                          compress_mode_t mode,
+                          uint32_t **costs);
+
+int compress_blocks(struct compress_ctx *ctx,
+                    struct compress_block *blocks,
+                    size_t nr_blocks,
+                    size_t overhead,
+                    compress_mode_t *mode);
 
-int compress_8xp(uint8_t *data, size_t *size, compress_mode_t mode);
+int compress_8xp(struct compress_ctx *ctx, uint8_t *data, size_t *size, compress_mode_t mode);
 
 #ifdef __cplusplus
 }
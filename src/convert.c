@@ -31,6 +31,7 @@
 #include "convert.h"
 #include "extract.h"
 #include "log.h"
+#include "thread.h"
 #include "deps/miniz/miniz.h"
 
 #include <stdio.h>
@@ -38,6 +39,384 @@
 #include <string.h>
 #include <time.h>
 
+#define CONVERT_SPLIT_MAX_APPVARS 99
+#define CONVERT_SPLIT_HEADER_LEN 3
+#define CONVERT_SPLIT_PLAN_TRIES 8
+/* bytes of each appvar the planner leaves for error in its size estimates */
+#define CONVERT_SPLIT_PLAN_SLACK 64
+#define CONVERT_SPLIT_CHUNK_MAX 0xffffff
+
+/*
+ * Compresses a -p input and swaps its data for the result, which may be
+ * larger than the input when the data does not compress.
+ */
+static int convert_compress_file(struct compress_ctx *ctx, struct input_file *file, int32_t *delta)
+{
+    uint8_t *compressed_data = NULL;
+    size_t compressed_size = 0;
+
+    if (compress_array_alloc(ctx, file->data, file->size,
+            &compressed_data, &compressed_size, delta, &file->compression) != 0)
+    {
+        return -1;
+    }
+
+    if (compressed_data != NULL)
+    {
+        input_set_data(file, compressed_data, compressed_size);
+    }
+
+    return 0;
+}
+
+struct convert_compress_pool
+{
+    struct input *input;
+    const uint8_t *window;
+    const size_t *window_sizes;
+    struct thread_mutex lock;
+    uint32_t next;
+    int ret;
+};
+
+static void convert_compress_worker(void *arg)
+{
+    struct convert_compress_pool *pool = arg;
+    struct compress_ctx ctx;
+
+    compress_ctx_init(&ctx, &pool->input->compress_options);
+    ctx.nr_threads = 1;
+    ctx.progress = false;
+
+    for (;;)
+    {
+        struct input_file *file = NULL;
+        uint32_t index = 0;
+        int32_t delta;
+
+        thread_mutex_lock(&pool->lock);
+        while (pool->ret == 0 && pool->next < pool->input->nr_files)
+        {
+            index = pool->next++;
+
+            if (pool->input->files[index].compression != COMPRESS_NONE)
+            {
+                file = &pool->input->files[index];
+                break;
+            }
+        }
+        thread_mutex_unlock(&pool->lock);
+
+        if (file == NULL)
+        {
+            break;
+        }
+
+        ctx.prefix = pool->window;
+        ctx.prefix_size = pool->window_sizes[index];
+        ctx.checkpoint = file->name;
+
+        if (convert_compress_file(&ctx, file, &delta) < 0)
+        {
+            thread_mutex_lock(&pool->lock);
+            pool->ret = -1;
+            thread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    compress_ctx_free(&ctx);
+}
+
+/*
+ * Compresses the per-input payloads on up to input->nr_jobs threads. Each file
+ * is compressed in place, so the concatenation that follows is identical to a
+ * serial run regardless of the order the workers finish in. Returns 1 if the
+ * inputs were compressed, or 0 if they should be compressed serially.
+ */
+static int convert_compress_inputs(struct input *input,
+                                   const uint8_t *window,
+                                   const size_t *window_sizes)
+{
+    struct convert_compress_pool pool;
+    struct thread threads[INPUT_MAX_JOBS];
+    uint32_t nr_threads = 0;
+    uint32_t nr_jobs = 0;
+    uint32_t i;
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        if (input->files[i].compression != COMPRESS_NONE)
+        {
+            nr_jobs++;
+        }
+    }
+
+    if (nr_jobs > input->nr_jobs)
+    {
+        nr_jobs = input->nr_jobs;
+    }
+
+    if (nr_jobs <= 1)
+    {
+        return 0;
+    }
+
+    if (thread_mutex_init(&pool.lock) != 0)
+    {
+        return 0;
+    }
+
+    pool.input = input;
+    pool.window = window;
+    pool.window_sizes = window_sizes;
+    pool.next = 0;
+    pool.ret = 0;
+
+    LOG_INFO("Compressing inputs using %u jobs...\n", (unsigned int)nr_jobs);
+
+    /* the calling thread is one of the workers */
+    for (i = 1; i < nr_jobs; ++i)
+    {
+        if (thread_start(&threads[nr_threads], convert_compress_worker, &pool) != 0)
+        {
+            break;
+        }
+        nr_threads++;
+    }
+
+    convert_compress_worker(&pool);
+
+    for (i = 0; i < nr_threads; ++i)
+    {
+        if (thread_join(&threads[i]) != 0)
+        {
+            LOG_ERROR("Could not join compression thread.\n");
+            pool.ret = -1;
+        }
+    }
+
+    thread_mutex_destroy(&pool.lock);
+
+    return pool.ret != 0 ? -1 : 1;
+}
+
+struct convert_read_result
+{
+    int ret;
+    struct log_buffer log;
+};
+
+struct convert_read_pool
+{
+    struct input *input;
+    struct thread_mutex lock;
+    uint32_t next;
+    bool failed;
+    struct convert_read_result *results;
+};
+
+static void convert_read_worker(void *arg)
+{
+    struct convert_read_pool *pool = arg;
+
+    for (;;)
+    {
+        uint32_t index;
+        int ret;
+
+        thread_mutex_lock(&pool->lock);
+        if (pool->failed || pool->next >= pool->input->nr_files)
+        {
+            thread_mutex_unlock(&pool->lock);
+            break;
+        }
+        index = pool->next++;
+        thread_mutex_unlock(&pool->lock);
+
+        log_capture(&pool->results[index].log);
+        ret = input_read_file(&pool->input->files[index]);
+        log_capture(NULL);
+
+        thread_mutex_lock(&pool->lock);
+        pool->results[index].ret = ret;
+        if (ret != 0)
+        {
+            pool->failed = true;
+        }
+        thread_mutex_unlock(&pool->lock);
+    }
+}
+
+static int convert_read_serial(struct input *input)
+{
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        ret = input_read_file(&input->files[i]);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reads and parses the inputs on up to input->nr_jobs threads. Files are
+ * taken in command line order, so once one fails every earlier file has
+ * been read. Each file's messages are captured while it is read and printed
+ * in input order afterwards, up to and including the first failure, so the
+ * output is the same as a serial run's.
+ */
+static int convert_read_inputs(struct input *input)
+{
+    struct convert_read_pool pool;
+    struct thread threads[INPUT_MAX_JOBS];
+    bool joined = true;
+    uint32_t nr_threads = 0;
+    uint32_t nr_jobs;
+    uint32_t i;
+    int ret = 0;
+
+    nr_jobs = input->nr_files < input->nr_jobs ? input->nr_files : input->nr_jobs;
+    if (nr_jobs <= 1)
+    {
+        return convert_read_serial(input);
+    }
+
+    pool.results = malloc(input->nr_files * sizeof(struct convert_read_result));
+    if (pool.results == NULL)
+    {
+        return convert_read_serial(input);
+    }
+
+    if (log_capture_init() != 0 || thread_mutex_init(&pool.lock) != 0)
+    {
+        log_capture_free();
+        free(pool.results);
+        return convert_read_serial(input);
+    }
+
+    pool.input = input;
+    pool.next = 0;
+    pool.failed = false;
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        pool.results[i].ret = 0;
+        log_buffer_init(&pool.results[i].log);
+    }
+
+    /* the calling thread is one of the workers */
+    for (i = 1; i < nr_jobs; ++i)
+    {
+        if (thread_start(&threads[nr_threads], convert_read_worker, &pool) != 0)
+        {
+            break;
+        }
+        nr_threads++;
+    }
+
+    convert_read_worker(&pool);
+
+    for (i = 0; i < nr_threads; ++i)
+    {
+        if (thread_join(&threads[i]) != 0)
+        {
+            joined = false;
+        }
+    }
+
+    log_capture_free();
+    thread_mutex_destroy(&pool.lock);
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        if (joined && ret == 0 && i < pool.next)
+        {
+            log_buffer_flush(&pool.results[i].log);
+            ret = pool.results[i].ret;
+        }
+        else
+        {
+            log_buffer_free(&pool.results[i].log);
+        }
+    }
+
+    free(pool.results);
+
+    if (!joined)
+    {
+        LOG_ERROR("Could not join input thread.\n");
+        return -1;
+    }
+
+    return ret;
+}
+
+/*
+ * Builds the window that -p inputs are compressed against: the dictionary,
+ * followed with --compress-chain by the uncompressed data of every input.
+ * Input i may refer back into the first window_sizes[i] bytes, which is
+ * exactly what precedes it when the inputs are decompressed back to back
+ * after the dictionary. The window is left NULL if there is nothing in it.
+ */
+static int convert_compress_window(const struct input *input,
+                                   uint8_t **window,
+                                   size_t *window_sizes)
+{
+    size_t size = input->dict.size;
+    uint32_t i;
+
+    *window = NULL;
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        window_sizes[i] = 0;
+    }
+
+    if (input->compress_chain)
+    {
+        for (i = 0; i < input->nr_files; ++i)
+        {
+            size += input->files[i].size;
+        }
+    }
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    *window = malloc(size);
+    if (*window == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    size = input->dict.size;
+    if (size != 0)
+    {
+        memcpy(*window, input->dict.data, size);
+    }
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        window_sizes[i] = size;
+
+        if (input->compress_chain && input->files[i].size != 0)
+        {
+            memcpy(*window + size, input->files[i].data, input->files[i].size);
+            size += input->files[i].size;
+        }
+    }
+
+    return 0;
+}
+
 static int convert_build_data(struct input *input,
                               uint8_t *data,
                               size_t *size,
@@ -45,8 +424,13 @@ static int convert_build_data(struct input *input,
                               struct output_file *output_file,
                               compress_mode_t compression)
 {
+    struct compress_ctx ctx;
+    size_t *window_sizes;
+    uint8_t *window = NULL;
+    bool inputs_compressed;
     size_t tmp_size = 0;
     uint32_t i;
+    int ret = 0;
 
     if (data == NULL || size == NULL)
     {
@@ -54,27 +438,54 @@ static int convert_build_data(struct input *input,
         return -1;
     }
 
+    window_sizes = malloc((input->nr_files == 0 ? 1 : input->nr_files) * sizeof(size_t));
+    if (window_sizes == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    compress_ctx_init(&ctx, &input->compress_options);
+    ctx.verify = &output_file->verify;
+
+    ret = convert_compress_window(input, &window, window_sizes);
+    if (ret != 0)
+    {
+        goto cleanup;
+    }
+
+    ret = convert_compress_inputs(input, window, window_sizes);
+    if (ret < 0)
+    {
+        goto cleanup;
+    }
+
+    inputs_compressed = ret > 0;
+
     for (i = 0; i < input->nr_files; ++i)
     {
         struct input_file *file = &input->files[i];
 
-        if (file->compression != COMPRESS_NONE)
+        if (!inputs_compressed && file->compression != COMPRESS_NONE)
         {
             int32_t delta;
-            int ret;
 
-            ret = compress_array(file->data,
-                &file->size, &delta, &file->compression);
+            ctx.prefix = window;
+            ctx.prefix_size = window_sizes[i];
+            ctx.checkpoint = file->name;
+
+            ret = convert_compress_file(&ctx, file, &delta);
             if (ret < 0)
             {
-                return ret;
+                goto cleanup;
             }
         }
 
         if (tmp_size > max_size || file->size > max_size - tmp_size)
         {
             LOG_ERROR("Input too large.\n");
-            return -1;
+            ret = -1;
+            goto cleanup;
         }
 
         memcpy(data + tmp_size, file->data, file->size);
@@ -84,14 +495,17 @@ static int convert_build_data(struct input *input,
     if (compression != COMPRESS_NONE)
     {
         int32_t delta;
-        int ret;
 
         output_file->uncompressed_size = tmp_size;
 
-        ret = compress_array(data, &tmp_size, &delta, &compression);
+        ctx.prefix = input->dict.data;
+        ctx.prefix_size = input->dict.size;
+        ctx.checkpoint = output_file->name;
+
+        ret = compress_array(&ctx, data, &tmp_size, max_size, &delta, &compression);
         if (ret < 0)
         {
-            return ret;
+            goto cleanup;
         }
 
         output_file->compressed = ret == 0;
@@ -101,12 +515,19 @@ static int convert_build_data(struct input *input,
     if (tmp_size > max_size)
     {
         LOG_ERROR("Input too large.\n");
-        return -1;
+        ret = -1;
+        goto cleanup;
     }
 
     *size = tmp_size;
+    ret = 0;
 
-    return 0;
+cleanup:
+    compress_ctx_free(&ctx);
+    free(window_sizes);
+    free(window);
+
+    return ret;
 }
 
 static int convert_total_input_size(const struct input *input, size_t *total_size)
@@ -412,9 +833,15 @@ static int convert_split_var_name(const char *base_name,
     return 0;
 }
 
+/*
+ * Writes data across appvars of at most appvar_size bytes each. If
+ * chunk_sizes is given, it lists the size of each appvar's data in order
+ * instead, which must add up to data_size.
+ */
 static int convert_write_split_appvars(const uint8_t *data,
                                        size_t data_size,
                                        size_t appvar_size,
+                                       const size_t *chunk_sizes,
                                        const struct output_file *file,
                                        unsigned int max_appvars,
                                        bool append_output_suffix,
@@ -425,6 +852,7 @@ static int convert_write_split_appvars(const uint8_t *data,
     char **written_paths = NULL;
     unsigned int num_appvars;
     unsigned int written_count = 0;
+    size_t offset = 0;
     unsigned int i;
     int ret = -1;
 
@@ -440,7 +868,19 @@ static int convert_write_split_appvars(const uint8_t *data,
         return -1;
     }
 
-    num_appvars = (unsigned int)((data_size + appvar_size - 1) / appvar_size);
+    if (chunk_sizes != NULL)
+    {
+        for (num_appvars = 0; offset < data_size; ++num_appvars)
+        {
+            offset += chunk_sizes[num_appvars];
+        }
+        offset = 0;
+    }
+    else
+    {
+        num_appvars = (unsigned int)((data_size + appvar_size - 1) / appvar_size);
+    }
+
     if (num_appvars > max_appvars)
     {
         if (max_appvars == 99)
@@ -473,8 +913,7 @@ static int convert_write_split_appvars(const uint8_t *data,
 
     for (i = 0; i < num_appvars; ++i)
     {
-        size_t offset = (size_t)i * appvar_size;
-        size_t chunk_size = appvar_size;
+        size_t chunk_size = chunk_sizes != NULL ? chunk_sizes[i] : appvar_size;
         char outname[4096];
         char var_name[TI8X_VAR_NAME_LEN + 1];
         size_t var_name_len;
@@ -513,6 +952,8 @@ static int convert_write_split_appvars(const uint8_t *data,
             goto fail;
         }
 
+        offset += chunk_size;
+
         ret = output_write_file(&appvarfile);
         if (ret != 0)
         {
@@ -531,6 +972,12 @@ static int convert_write_split_appvars(const uint8_t *data,
             var_name,
             (unsigned long)appvarfile.size);
 
+        LOG_INFO("%s is %.1f%% full (%lu of %lu bytes).\n",
+            var_name,
+            100.0 * (double)chunk_size / (double)appvar_size,
+            (unsigned long)chunk_size,
+            (unsigned long)appvar_size);
+
         if (appvar_names != NULL)
         {
             appvar_names[i][0] = TI8X_TYPE_APPVAR;
@@ -592,8 +1039,15 @@ static int convert_8xp(struct input *input, struct output_file *file)
 
     if (file->format == OFORMAT_8XP_COMPRESSED)
     {
+        struct compress_ctx ctx;
+
+        compress_ctx_init(&ctx, &input->compress_options);
+        ctx.verify = &file->verify;
+        ctx.checkpoint = file->name;
+
         file->uncompressed_size = size;
-        ret = compress_8xp(data, &size, file->ti8xp_compression);
+        ret = compress_8xp(&ctx, data, &size, file->ti8xp_compression);
+        compress_ctx_free(&ctx);
         if (ret < 0)
         {
             free(data);
@@ -641,10 +1095,19 @@ static int convert_8xp(struct input *input, struct output_file *file)
             LOG_WARNING("Input does not start with ASM tokens; split output will replace first two bytes.\n");
         }
 
-        ret = convert_write_split_appvars(
-            data + split_offset,
-            payload_size,
+        /* the appvars are written right away, so the checks must be done first */
+        if (compress_verify_wait(&file->verify) != 0)
+        {
+            free(appvar_names);
+            free(data);
+            return -1;
+        }
+
+        ret = convert_write_split_appvars(
+            data + split_offset,
+            payload_size,
             file->var.maxsize,
+            NULL,
             file,
             99,
             true,
@@ -951,38 +1414,483 @@ static int convert_8ek(struct input *input, struct output_file *file)
     return 0;
 }
 
+/*
+ * Finds the longest chunk starting at pos whose compressed size is
+ * estimated to be at most budget bytes. The estimate comes from a quick
+ * parse from the chunk's own start, with the bits for each byte scaled by
+ * how the first pass compared to the same parse on that byte's block. The
+ * window parsed starts at guess bytes and grows until the chunk ends in it.
+ */
+static int convert_split_length(struct compress_ctx *ctx,
+                                const uint8_t *data,
+                                size_t size,
+                                size_t pos,
+                                compress_mode_t mode,
+                                size_t budget,
+                                const double *scales,
+                                size_t block_size,
+                                size_t guess,
+                                size_t *length,
+                                double *estimate)
+{
+    size_t window = guess > 0 ? guess : 1;
+
+    for (;;)
+    {
+        uint32_t *costs;
+        uint32_t prev = 0;
+        double bits = 0;
+        size_t i;
+
+        if (window > size - pos)
+        {
+            window = size - pos;
+        }
+        if (window > CONVERT_SPLIT_CHUNK_MAX)
+        {
+            window = CONVERT_SPLIT_CHUNK_MAX;
+        }
+
+        if (compress_prefix_costs(ctx, data + pos, window, mode, &costs) != 0)
+        {
+            return -1;
+        }
+
+        for (i = 0; i < window; ++i)
+        {
+            double next = bits + scales[(pos + i) / block_size] * (costs[i] - prev);
+
+            if (next > (double)budget * 8 && i > 0)
+            {
+                break;
+            }
+            bits = next;
+            prev = costs[i];
+        }
+
+        free(costs);
+
+        if (i < window || window == size - pos || window == CONVERT_SPLIT_CHUNK_MAX)
+        {
+            *length = i;
+            *estimate = bits;
+            return 0;
+        }
+
+        window *= 2;
+    }
+}
+
+/*
+ * Plans the chunks so each compressed chunk nearly fills its appvar. The
+ * chunks are cut from size estimates, leaving CONVERT_SPLIT_PLAN_SLACK bytes
+ * of each appvar for estimation error, and then all compressed at once
+ * with compress_blocks. blocks are the chunks of the first pass, which the
+ * estimates are scaled by. After each pass the scales are corrected by how
+ * far off the estimates were. A chunk that still does not fit is shrunk by
+ * how much it overflowed and the chunks after it are planned again; if the
+ * chunks could fit in fewer appvars, they are all planned again.
+ */
+static int convert_plan_split(const struct compress_options *options,
+                              const uint8_t *data,
+                              size_t size,
+                              size_t limit,
+                              const struct compress_block *blocks,
+                              size_t nr_blocks,
+                              compress_mode_t mode,
+                              struct compress_block *chunks,
+                              size_t *nr_chunks)
+{
+    double estimates[CONVERT_SPLIT_MAX_APPVARS];
+    struct compress_ctx ctx;
+    double *scales;
+    size_t block_size = blocks[0].size;
+    size_t compressed = 0;
+    size_t total;
+    size_t budget;
+    size_t guess;
+    size_t forced = 0;
+    size_t pos = 0;
+    size_t nr = 0;
+    unsigned int tries = 0;
+    size_t i;
+    int ret = -1;
+
+    *nr_chunks = 0;
+
+    budget = limit > CONVERT_SPLIT_HEADER_LEN + CONVERT_SPLIT_PLAN_SLACK ?
+        limit - CONVERT_SPLIT_HEADER_LEN - CONVERT_SPLIT_PLAN_SLACK : 1;
+
+    scales = malloc(nr_blocks * sizeof(double));
+    if (scales == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    compress_ctx_init(&ctx, options);
+    ctx.progress = false;
+
+    LOG_INFO("Planning appvars to fit the compressed data...\n");
+
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        uint32_t *costs;
+        uint32_t estimate;
+
+        if (compress_prefix_costs(&ctx, blocks[i].data, blocks[i].size, mode, &costs) != 0)
+        {
+            goto cleanup;
+        }
+
+        estimate = costs[blocks[i].size - 1];
+        free(costs);
+
+        scales[i] = estimate > 0 ? (double)blocks[i].out_size * 8 / estimate : 1;
+        compressed += blocks[i].out_size;
+    }
+
+    /* a little over the length the first pass suggests */
+    guess = (size_t)((double)size * budget / (compressed > 0 ? compressed : 1));
+    guess += guess / 8;
+
+    while (pos < size)
+    {
+        compress_mode_t chunk_mode = mode;
+        size_t nr_planned = nr;
+        size_t next = pos;
+
+        if (tries++ == CONVERT_SPLIT_PLAN_TRIES)
+        {
+            LOG_ERROR("Could not fit compressed data in an AppVar.\n");
+            goto cleanup;
+        }
+
+        while (next < size)
+        {
+            size_t len = forced;
+
+            estimates[nr_planned] = 0;
+
+            if (nr_planned == CONVERT_SPLIT_MAX_APPVARS)
+            {
+                LOG_ERROR("Data too large, would require more than 99 AppVars.\n");
+                goto cleanup;
+            }
+
+            if (nr_planned != nr || forced == 0)
+            {
+                if (convert_split_length(&ctx, data, size, next, mode, budget,
+                        scales, block_size, guess, &len, &estimates[nr_planned]) != 0)
+                {
+                    goto cleanup;
+                }
+            }
+
+            chunks[nr_planned].data = data + next;
+            chunks[nr_planned].size = len;
+            chunks[nr_planned].out_data = NULL;
+            next += len;
+            nr_planned++;
+        }
+
+        if (compress_blocks(&ctx, chunks + nr, nr_planned - nr,
+                (nr_planned - nr) * CONVERT_SPLIT_HEADER_LEN, &chunk_mode) != 0)
+        {
+            goto cleanup;
+        }
+
+        /* correct each block's scale by the chunk its middle is in */
+        for (i = nr; i < nr_planned; ++i)
+        {
+            size_t start = (size_t)(chunks[i].data - data);
+            size_t block;
+
+            if (estimates[i] <= 0)
+            {
+                continue;
+            }
+
+            for (block = start / block_size; block < nr_blocks; ++block)
+            {
+                size_t middle = block * block_size + block_size / 2;
+
+                if (middle >= start + chunks[i].size)
+                {
+                    break;
+                }
+                if (middle >= start)
+                {
+                    scales[block] *= (double)chunks[i].out_size * 8 / estimates[i];
+                }
+            }
+        }
+
+        /* keep the chunks up to the first that does not fit */
+        forced = 0;
+        total = 0;
+        for (i = nr; i < nr_planned; ++i)
+        {
+            total += CONVERT_SPLIT_HEADER_LEN + chunks[i].out_size;
+            if (CONVERT_SPLIT_HEADER_LEN + chunks[i].out_size > limit)
+            {
+                forced = (size_t)((double)chunks[i].size * budget / chunks[i].out_size);
+                if (forced >= chunks[i].size)
+                {
+                    forced = chunks[i].size - 1;
+                }
+                if (forced == 0)
+                {
+                    forced = 1;
+                }
+                break;
+            }
+        }
+
+        /* plan all of them again if they could use fewer appvars */
+        if (i == nr_planned && tries < CONVERT_SPLIT_PLAN_TRIES &&
+            (total + limit - 1) / limit < nr_planned - nr)
+        {
+            i = nr;
+        }
+        else if (i > nr)
+        {
+            /* each chunk gets a few tries to fit */
+            tries = 0;
+        }
+
+        nr = i;
+        pos = nr < nr_planned ? (size_t)(chunks[nr].data - data) : size;
+
+        for (; i < nr_planned; ++i)
+        {
+            free(chunks[i].out_data);
+            chunks[i].out_data = NULL;
+        }
+    }
+
+    *nr_chunks = nr;
+    ret = 0;
+
+cleanup:
+    compress_ctx_free(&ctx);
+    free(scales);
+
+    if (ret != 0)
+    {
+        while (nr > 0)
+        {
+            free(chunks[--nr].out_data);
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Cuts the data into chunks and compresses each one on its own. Chunks of
+ * --maxvarsize bytes are compressed first on all cores; if the result could
+ * fit in fewer appvars, or a chunk does not fit at all, the chunks are
+ * planned again so each compressed chunk fills its appvar. Each compressed
+ * chunk is prefixed with its uncompressed size as a 24-bit little endian
+ * value, so the appvars can be decompressed in any order. The chunks are
+ * packed back to back into a new buffer.
+ */
+static int convert_compress_split(const struct compress_options *options,
+                                  const uint8_t *data,
+                                  size_t size,
+                                  struct output_file *file,
+                                  uint8_t **out_data,
+                                  size_t *out_size,
+                                  size_t *chunk_sizes)
+{
+    struct compress_block blocks[CONVERT_SPLIT_MAX_APPVARS];
+    struct compress_block planned[CONVERT_SPLIT_MAX_APPVARS];
+    struct compress_block *chunks = blocks;
+    struct compress_ctx ctx;
+    compress_mode_t mode = file->compression;
+    size_t chunk_size = file->var.maxsize;
+    size_t nr_blocks;
+    size_t nr_planned = 0;
+    size_t nr_chunks;
+    size_t total = 0;
+    size_t pos = 0;
+    bool fits = true;
+    size_t i;
+    int ret;
+
+    nr_blocks = (size + chunk_size - 1) / chunk_size;
+    if (nr_blocks == 0)
+    {
+        LOG_ERROR("Input too small for split appvars.\n");
+        return -1;
+    }
+
+    if (nr_blocks > CONVERT_SPLIT_MAX_APPVARS)
+    {
+        LOG_ERROR("Data too large, would require more than 99 AppVars.\n");
+        return -1;
+    }
+
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        size_t offset = i * chunk_size;
+
+        blocks[i].data = data + offset;
+        blocks[i].size = size - offset < chunk_size ? size - offset : chunk_size;
+        blocks[i].out_data = NULL;
+    }
+
+    compress_ctx_init(&ctx, options);
+    ret = compress_blocks(&ctx, blocks, nr_blocks,
+        nr_blocks * CONVERT_SPLIT_HEADER_LEN, &mode);
+    compress_ctx_free(&ctx);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        total += CONVERT_SPLIT_HEADER_LEN + blocks[i].out_size;
+        if (CONVERT_SPLIT_HEADER_LEN + blocks[i].out_size > chunk_size)
+        {
+            fits = false;
+        }
+    }
+
+    nr_chunks = nr_blocks;
+
+    if (!fits || (total + chunk_size - 1) / chunk_size < nr_blocks)
+    {
+        ret = convert_plan_split(options, data, size, chunk_size,
+            blocks, nr_blocks, mode, planned, &nr_planned);
+        if (ret != 0)
+        {
+            goto cleanup;
+        }
+
+        if (!fits || nr_planned < nr_blocks)
+        {
+            chunks = planned;
+            nr_chunks = nr_planned;
+        }
+    }
+
+    total = 0;
+    for (i = 0; i < nr_chunks; ++i)
+    {
+        chunk_sizes[i] = CONVERT_SPLIT_HEADER_LEN + chunks[i].out_size;
+        total += chunk_sizes[i];
+    }
+
+    *out_data = malloc(total);
+    if (*out_data == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (i = 0; i < nr_chunks; ++i)
+    {
+        uint8_t *chunk = *out_data + pos;
+
+        chunk[0] = (chunks[i].size >> 0) & 0xff;
+        chunk[1] = (chunks[i].size >> 8) & 0xff;
+        chunk[2] = (chunks[i].size >> 16) & 0xff;
+        memcpy(chunk + CONVERT_SPLIT_HEADER_LEN, chunks[i].out_data, chunks[i].out_size);
+        pos += chunk_sizes[i];
+    }
+
+    *out_size = total;
+
+    file->compression = mode;
+    file->compressed = true;
+    file->uncompressed_size = size;
+    file->compressed_size = total;
+
+cleanup:
+    for (i = 0; i < nr_blocks; ++i)
+    {
+        free(blocks[i].out_data);
+    }
+    for (i = 0; i < nr_planned; ++i)
+    {
+        free(planned[i].out_data);
+    }
+
+    return ret;
+}
+
 static int convert_8xv_split(struct input *input, struct output_file *file)
 {
+    size_t chunk_sizes[CONVERT_SPLIT_MAX_APPVARS];
+    uint8_t *compressed_data = NULL;
     uint8_t *data;
     size_t capacity = 0;
     size_t size = 0;
     int ret;
 
-    if (file->compression != COMPRESS_NONE)
+    /* the chunks are compressed out of place, so a lone input is read where it is */
+    if (file->compression != COMPRESS_NONE &&
+        input->nr_files == 1 &&
+        input->files[0].compression == COMPRESS_NONE)
     {
-        LOG_WARNING("Ignoring compression mode!\n");
-    }
+        ret = convert_compress_split(&input->compress_options,
+            input->files[0].data, input->files[0].size,
+            file, &compressed_data, &size, chunk_sizes);
+        if (ret != 0)
+        {
+            return ret;
+        }
 
-    ret = convert_alloc_input_buffer(input, &data, &capacity);
-    if (ret != 0)
+        data = compressed_data;
+    }
+    else
     {
-        return ret;
+        ret = convert_alloc_input_buffer(input, &data, &capacity);
+        if (ret != 0)
+        {
+            return ret;
+        }
+
+        ret = convert_build_data(input, data, &size,
+                                 capacity, file, COMPRESS_NONE);
+        if (ret < 0)
+        {
+            free(data);
+            return ret;
+        }
+
+        if (file->compression != COMPRESS_NONE)
+        {
+            ret = convert_compress_split(&input->compress_options,
+                data, size, file,
+                &compressed_data, &size, chunk_sizes);
+            free(data);
+            if (ret != 0)
+            {
+                return ret;
+            }
+
+            data = compressed_data;
+        }
     }
 
-    ret = convert_build_data(input, data, &size,
-                             capacity, file, COMPRESS_NONE);
-    if (ret < 0)
+    if (compress_verify_wait(&file->verify) != 0)
     {
         free(data);
-        return ret;
+        return -1;
     }
 
     ret = convert_write_split_appvars(
         data,
         size,
         file->var.maxsize,
+        compressed_data != NULL ? chunk_sizes : NULL,
         file,
-        99,
+        CONVERT_SPLIT_MAX_APPVARS,
         false,
         NULL,
         NULL);
@@ -992,20 +1900,35 @@ static int convert_8xv_split(struct input *input, struct output_file *file)
 
 int convert_bin(struct input *input, struct output_file *file)
 {
+    size_t total_size = 0;
     size_t max_size = 0;
     uint32_t i;
 
+    /* binary output has no size limit, so leave room for data that grows */
     for (i = 0; i < input->nr_files; ++i)
     {
-        if (max_size > (size_t)-1 - input->files[i].size)
+        size_t size = input->files[i].size;
+
+        if (input->files[i].compression != COMPRESS_NONE)
+        {
+            size = compress_bound(&input->compress_options, size);
+        }
+
+        if (max_size > (size_t)-1 - size)
         {
             LOG_ERROR("Input too large.\n");
             return -1;
         }
-        max_size += input->files[i].size;
+        max_size += size;
+        total_size += input->files[i].size;
+    }
+
+    if (file->compression != COMPRESS_NONE)
+    {
+        max_size = compress_bound(&input->compress_options, max_size);
     }
 
-    if (max_size == 0 && file->compression == COMPRESS_NONE)
+    if (total_size == 0 && file->compression == COMPRESS_NONE)
     {
         if (output_reserve_data(file, 1) != 0)
         {
@@ -1028,15 +1951,208 @@ int convert_bin(struct input *input, struct output_file *file)
         file->compression);
 }
 
+static void convert_report(const struct input *input, const struct output_file *file)
+{
+    if ((file->compression || file->format == OFORMAT_8XP_COMPRESSED) &&
+        file->compressed)
+    {
+        float savings = (float)file->uncompressed_size -
+                        (float)file->compressed_size;
+
+        if (savings < 0.001)
+        {
+            savings = 0;
+        }
+        else
+        {
+            if (file->uncompressed_size != 0)
+            {
+                savings /= (float)file->uncompressed_size;
+            }
+        }
+
+        const char *compress_str =
+            (file->format == OFORMAT_8XP_COMPRESSED && file->ti8xp_compression == COMPRESS_ZX7) ||
+            (file->compression == COMPRESS_ZX7) ? "zx7" : "zx0";
+
+        LOG_PRINT("[success] %s, %lu bytes. (%s compressed %.2f%%)\n",
+            file->name,
+            (unsigned long)file->size,
+            compress_str,
+            savings * 100.0);
+    }
+    else
+    {
+        if (file->format == OFORMAT_8EK)
+        {
+            LOG_PRINT("[success] %s, %lu bytes. (%lu relocations)\n",
+                file->name,
+                (unsigned long)file->size,
+                (unsigned long)(input->files[0].reloc_table.size / 6));
+        }
+        else
+        {
+            LOG_PRINT("[success] %s, %lu bytes.\n",
+                file->name,
+                (unsigned long)file->size);
+        }
+    }
+}
+
+/*
+ * CSV inputs written uncompressed to a C, assembly, ICE or binary output
+ * are never held in memory: they are counted when read, then parsed again
+ * a chunk at a time straight into the output file.
+ */
+static bool convert_can_stream(const struct input *input, const struct output_file *file)
+{
+    bool csv = false;
+    uint32_t i;
+
+    switch (file->format)
+    {
+        case OFORMAT_C:
+        case OFORMAT_ASM:
+        case OFORMAT_ICE:
+        case OFORMAT_BIN:
+            break;
+
+        default:
+            return false;
+    }
+
+    if (file->compression != COMPRESS_NONE)
+    {
+        return false;
+    }
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        if (input->files[i].compression != COMPRESS_NONE)
+        {
+            return false;
+        }
+
+        if (input->files[i].format == IFORMAT_CSV)
+        {
+            csv = true;
+        }
+    }
+
+    return csv;
+}
+
+static int convert_stream(struct input *input, struct output_file *file)
+{
+    struct output_stream stream;
+    uint8_t *chunk = NULL;
+    size_t size;
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        input->files[i].stream = input->files[i].format == IFORMAT_CSV;
+    }
+
+    ret = convert_read_inputs(input);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    ret = convert_total_input_size(input, &size);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    chunk = malloc(INPUT_CSV_CHUNK_SIZE);
+    if (chunk == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    ret = output_stream_open(&stream, file, size);
+    if (ret != 0)
+    {
+        free(chunk);
+        return ret;
+    }
+
+    for (i = 0; ret == 0 && i < input->nr_files; ++i)
+    {
+        struct input_file *input_file = &input->files[i];
+        struct input_csv csv;
+        size_t count;
+
+        if (!input_file->stream)
+        {
+            ret = output_stream_write(&stream, input_file->data, input_file->size);
+            input_free_file(input_file);
+            continue;
+        }
+
+        ret = input_csv_open(&csv, input_file->name);
+        if (ret != 0)
+        {
+            break;
+        }
+
+        do
+        {
+            ret = input_csv_read(&csv, chunk, INPUT_CSV_CHUNK_SIZE, &count);
+            if (ret == 0 && count != 0)
+            {
+                ret = output_stream_write(&stream, chunk, count);
+            }
+        } while (ret == 0 && count != 0);
+
+        input_csv_close(&csv);
+    }
+
+    if (output_stream_close(&stream) != 0)
+    {
+        ret = -1;
+    }
+
+    free(chunk);
+
+    file->size = size;
+
+    return ret;
+}
+
 int convert_normal(struct input *input, struct output *output)
 {
     struct output_file *file = &output->file;
-    unsigned int i;
     int ret = 0;
 
-    for (i = 0; i < input->nr_files; ++i)
+    if (convert_can_stream(input, file))
     {
-        ret = input_read_file(&input->files[i]);
+        ret = convert_stream(input, file);
+        if (ret != 0)
+        {
+            return ret;
+        }
+
+        convert_report(input, file);
+
+        return 0;
+    }
+
+    ret = convert_read_inputs(input);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    compress_verify_init(&file->verify);
+
+    if (input->dict.name != NULL)
+    {
+        ret = input_read_file(&input->dict);
         if (ret != 0)
         {
             return ret;
@@ -1071,7 +2187,9 @@ int convert_normal(struct input *input, struct output *output)
             break;
 
         case OFORMAT_8XV_SPLIT:
-            return convert_8xv_split(input, file);
+            ret = convert_8xv_split(input, file);
+            compress_verify_wait(&file->verify);
+            return ret;
 
         default:
             ret = -1;
@@ -1080,60 +2198,32 @@ int convert_normal(struct input *input, struct output *output)
 
     if (ret != 0)
     {
+        compress_verify_wait(&file->verify);
         return ret;
     }
 
+    /* appending cannot be undone, so check the results first */
+    if (file->append && compress_verify_wait(&file->verify) != 0)
+    {
+        return -1;
+    }
+
     ret = output_write_file(file);
     if (ret != 0)
     {
+        compress_verify_wait(&file->verify);
         return ret;
     }
 
-    if ((file->compression || file->format == OFORMAT_8XP_COMPRESSED) &&
-        file->compressed)
-    {
-        float savings = (float)file->uncompressed_size -
-                        (float)file->compressed_size;
-
-        if (savings < 0.001)
-        {
-            savings = 0;
-        }
-        else
-        {
-            if (file->uncompressed_size != 0)
-            {
-                savings /= (float)file->uncompressed_size;
-            }
-        }
-
-        const char *compress_str =
-            (file->format == OFORMAT_8XP_COMPRESSED && file->ti8xp_compression == COMPRESS_ZX7) ||
-            (file->compression == COMPRESS_ZX7) ? "zx7" : "zx0";
-
-        LOG_PRINT("[success] %s, %lu bytes. (%s compressed %.2f%%)\n",
-            file->name,
-            (unsigned long)file->size,
-            compress_str,
-            savings * 100.0);
-    }
-    else
+    /* otherwise the output is written while the last result is checked */
+    if (compress_verify_wait(&file->verify) != 0)
     {
-        if (file->format == OFORMAT_8EK)
-        {
-            LOG_PRINT("[success] %s, %lu bytes. (%lu relocations)\n",
-                file->name,
-                (unsigned long)file->size,
-                (unsigned long)(input->files[0].reloc_table.size / 6));
-        }
-        else
-        {
-            LOG_PRINT("[success] %s, %lu bytes.\n",
-                file->name,
-                (unsigned long)file->size);
-        }
+        remove(file->name);
+        return -1;
     }
 
+    convert_report(input, file);
+
     return 0;
 }
 
@@ -1297,3 +2387,76 @@ int convert_input_to_output(struct input *input, struct output *output)
         return convert_normal(input, output);
     }
 }
+
+/*
+ * Prints the size of each input and what each codec would compress it to,
+ * without converting anything. Inputs are sized on their own, as if
+ * compressed with -p and no dictionary.
+ */
+int convert_estimate(struct input *input)
+{
+    struct compress_ctx ctx;
+    size_t total_size = 0;
+    size_t total_zx7 = 0;
+    size_t total_zx0 = 0;
+    uint32_t i;
+    int ret = 0;
+
+    ret = convert_read_inputs(input);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    compress_ctx_init(&ctx, &input->compress_options);
+    ctx.progress = false;
+
+    LOG_PRINT("%-32s %10s %16s %16s\n", "input", "size", "zx7", "zx0");
+
+    for (i = 0; i < input->nr_files; ++i)
+    {
+        const struct input_file *file = &input->files[i];
+        struct compress_sizes sizes;
+
+        if (file->size == 0)
+        {
+            sizes.zx7_size = 0;
+            sizes.zx0_size = 0;
+        }
+        else
+        {
+            ret = compress_estimate(&ctx, file->data, file->size, COMPRESS_AUTO, &sizes);
+            if (ret != 0)
+            {
+                break;
+            }
+        }
+
+        LOG_PRINT("%-32s %10lu %8lu (%4.1f%%) %8lu (%4.1f%%)\n",
+            file->name,
+            (unsigned long)file->size,
+            (unsigned long)sizes.zx7_size,
+            file->size ? 100.0 * (double)sizes.zx7_size / (double)file->size : 0.0,
+            (unsigned long)sizes.zx0_size,
+            file->size ? 100.0 * (double)sizes.zx0_size / (double)file->size : 0.0);
+
+        total_size += file->size;
+        total_zx7 += sizes.zx7_size;
+        total_zx0 += sizes.zx0_size;
+    }
+
+    if (ret == 0 && input->nr_files > 1)
+    {
+        LOG_PRINT("%-32s %10lu %8lu (%4.1f%%) %8lu (%4.1f%%)\n",
+            "total",
+            (unsigned long)total_size,
+            (unsigned long)total_zx7,
+            total_size ? 100.0 * (double)total_zx7 / (double)total_size : 0.0,
+            (unsigned long)total_zx0,
+            total_size ? 100.0 * (double)total_zx0 / (double)total_size : 0.0);
+    }
+
+    compress_ctx_free(&ctx);
+
+    return ret;
+}
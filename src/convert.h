@@ -40,6 +40,8 @@ extern "C" {
 
 int convert_input_to_output(struct input *input, struct output *output);
 
+int convert_estimate(struct input *input);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,499 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "decompress.h"
+#include "zx0.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define DECOMPRESS_MAX_VALUE 0x3fffffff
+#define DECOMPRESS_MIN_CAPACITY 256
+
+/*
+ * Rough eZ80 cycle costs of the decompressors in src/asm, counted from the
+ * instruction timings with no memory wait states. Only meant to rank the
+ * codecs against each other, not to predict exact run times.
+ */
+struct decompress_cost
+{
+    unsigned int bit;
+    unsigned int bit_byte;
+    unsigned int literal;
+    unsigned int literal_run;
+    unsigned int match;
+    unsigned int new_offset;
+    unsigned int match_byte;
+};
+
+/* bits are read inline, literal runs and matches are copied with ldir */
+static const struct decompress_cost decompress_zx0_cost =
+{
+    5, 4, 3, 20, 36, 30, 3
+};
+
+/* every bit is a call, literals are copied one at a time with ldi */
+static const struct decompress_cost decompress_zx7_cost =
+{
+    14, 4, 8, 0, 55, 0, 3
+};
+
+struct decompress_reader
+{
+    const uint8_t *data;
+    size_t size;
+    size_t index;
+    int bit_mask;
+    int bit_value;
+    int last_byte;
+    bool backtrack;
+    bool error;
+    struct decompress_stats stats;
+    uint8_t *out_data;
+    size_t out_size;
+    size_t out_capacity;
+    size_t prefix_size;
+};
+
+static int decompress_reserve(struct decompress_reader *r, size_t length);
+
+static void decompress_reader_init(struct decompress_reader *r,
+                                   const uint8_t *prefix,
+                                   size_t prefix_size,
+                                   const uint8_t *data,
+                                   size_t size)
+{
+    r->data = data;
+    r->size = size;
+    r->index = 0;
+    r->bit_mask = 0;
+    r->bit_value = 0;
+    r->last_byte = 0;
+    r->backtrack = false;
+    r->error = false;
+    memset(&r->stats, 0, sizeof r->stats);
+    r->out_data = NULL;
+    r->out_size = 0;
+    r->out_capacity = 0;
+    r->prefix_size = 0;
+
+    /* matches may reach back into the prefix, so it starts the output */
+    if (prefix_size != 0 && decompress_reserve(r, prefix_size) == 0)
+    {
+        memcpy(r->out_data, prefix, prefix_size);
+        r->out_size = prefix_size;
+        r->prefix_size = prefix_size;
+    }
+}
+
+static int decompress_read_byte(struct decompress_reader *r)
+{
+    if (r->index >= r->size)
+    {
+        r->error = true;
+        return 0;
+    }
+
+    r->last_byte = r->data[r->index++];
+
+    return r->last_byte;
+}
+
+static int decompress_read_bit(struct decompress_reader *r)
+{
+    int bit;
+
+    if (r->backtrack)
+    {
+        r->backtrack = false;
+        return r->last_byte & 1;
+    }
+
+    if (r->bit_mask == 0)
+    {
+        r->bit_mask = 128;
+        r->bit_value = decompress_read_byte(r);
+        r->stats.nr_bit_bytes++;
+    }
+
+    r->stats.nr_bits++;
+
+    bit = (r->bit_value & r->bit_mask) ? 1 : 0;
+    r->bit_mask >>= 1;
+
+    return bit;
+}
+
+static int decompress_reserve(struct decompress_reader *r, size_t length)
+{
+    size_t capacity;
+    uint8_t *out_data;
+
+    if (length <= r->out_capacity - r->out_size)
+    {
+        return 0;
+    }
+
+    if (length > (size_t)-1 / 2 - r->out_size)
+    {
+        r->error = true;
+        return -1;
+    }
+
+    capacity = r->out_capacity * 2;
+    if (capacity < r->out_size + length)
+    {
+        capacity = r->out_size + length;
+    }
+    if (capacity < DECOMPRESS_MIN_CAPACITY)
+    {
+        capacity = DECOMPRESS_MIN_CAPACITY;
+    }
+
+    out_data = realloc(r->out_data, capacity);
+    if (out_data == NULL)
+    {
+        r->error = true;
+        return -1;
+    }
+
+    r->out_data = out_data;
+    r->out_capacity = capacity;
+
+    return 0;
+}
+
+static void decompress_write_byte(struct decompress_reader *r, int value)
+{
+    if (r->error || decompress_reserve(r, 1) != 0)
+    {
+        return;
+    }
+
+    r->out_data[r->out_size++] = (uint8_t)value;
+}
+
+static void decompress_copy(struct decompress_reader *r, size_t offset, size_t length)
+{
+    size_t i;
+
+    if (r->error)
+    {
+        return;
+    }
+
+    if (offset == 0 || offset > r->out_size || decompress_reserve(r, length) != 0)
+    {
+        r->error = true;
+        return;
+    }
+
+    r->stats.nr_matches++;
+    r->stats.nr_match_bytes += length;
+
+    /* byte by byte, as the source may overlap what is being written */
+    for (i = 0; i < length; ++i)
+    {
+        r->out_data[r->out_size] = r->out_data[r->out_size - offset];
+        r->out_size++;
+    }
+}
+
+static int decompress_finish(struct decompress_reader *r,
+                             uint8_t **out_data,
+                             size_t *out_size,
+                             struct decompress_stats *stats)
+{
+    if (r->error)
+    {
+        free(r->out_data);
+        return -1;
+    }
+
+    if (r->out_data == NULL)
+    {
+        r->out_data = malloc(1);
+        if (r->out_data == NULL)
+        {
+            return -1;
+        }
+    }
+
+    memmove(r->out_data, r->out_data + r->prefix_size, r->out_size - r->prefix_size);
+
+    *out_data = r->out_data;
+    *out_size = r->out_size - r->prefix_size;
+
+    if (stats != NULL)
+    {
+        *stats = r->stats;
+    }
+
+    return 0;
+}
+
+static size_t decompress_zx0_elias_gamma(struct decompress_reader *r, int inverted)
+{
+    size_t value = 1;
+
+    while (!r->error && !decompress_read_bit(r))
+    {
+        if (value > DECOMPRESS_MAX_VALUE / 2)
+        {
+            r->error = true;
+            break;
+        }
+        value = (value << 1) | (decompress_read_bit(r) ^ inverted);
+    }
+
+    return value;
+}
+
+static void decompress_zx0(struct decompress_reader *r)
+{
+    size_t last_offset = ZX0_INITIAL_OFFSET;
+    size_t length;
+    size_t i;
+
+    while (!r->error)
+    {
+        /* copy literals */
+        length = decompress_zx0_elias_gamma(r, 0);
+        for (i = 0; i < length && !r->error; ++i)
+        {
+            decompress_write_byte(r, decompress_read_byte(r));
+        }
+        r->stats.nr_literals += length;
+        r->stats.nr_literal_runs++;
+
+        if (!decompress_read_bit(r))
+        {
+            /* copy from last offset */
+            length = decompress_zx0_elias_gamma(r, 0);
+            decompress_copy(r, last_offset, length);
+
+            if (!decompress_read_bit(r))
+            {
+                continue;
+            }
+        }
+
+        /* copy from new offsets until the next literals */
+        do
+        {
+            size_t msb = decompress_zx0_elias_gamma(r, 1);
+
+            if (r->error)
+            {
+                break;
+            }
+
+            if (msb == 256)
+            {
+                return;
+            }
+
+            r->stats.nr_new_offsets++;
+
+            last_offset = msb * 128 - (size_t)(decompress_read_byte(r) >> 1);
+            r->backtrack = true;
+            length = decompress_zx0_elias_gamma(r, 0) + 1;
+            decompress_copy(r, last_offset, length);
+        } while (!r->error && decompress_read_bit(r));
+    }
+}
+
+static void decompress_zx7(struct decompress_reader *r)
+{
+    /* first byte is always literal */
+    decompress_write_byte(r, decompress_read_byte(r));
+
+    while (!r->error)
+    {
+        if (!decompress_read_bit(r))
+        {
+            decompress_write_byte(r, decompress_read_byte(r));
+            r->stats.nr_literals++;
+        }
+        else
+        {
+            size_t length = 1;
+            size_t offset;
+            int nr_bits = 0;
+
+            while (!r->error && !decompress_read_bit(r))
+            {
+                nr_bits++;
+            }
+
+            /* sixteen zero bits mark the end of the stream */
+            if (nr_bits > 15)
+            {
+                break;
+            }
+
+            while (nr_bits--)
+            {
+                length = (length << 1) | decompress_read_bit(r);
+            }
+
+            offset = decompress_read_byte(r);
+            if (offset >= 128)
+            {
+                size_t msb = 0;
+                int i;
+
+                for (i = 0; i < 4; ++i)
+                {
+                    msb = (msb << 1) | decompress_read_bit(r);
+                }
+
+                offset = ((offset & 127) | (msb << 7)) + 128;
+            }
+
+            decompress_copy(r, offset + 1, length + 1);
+        }
+    }
+}
+
+static int decompress_run(const uint8_t *prefix,
+                          size_t prefix_size,
+                          const uint8_t *data,
+                          size_t size,
+                          compress_mode_t mode,
+                          uint8_t **out_data,
+                          size_t *out_size,
+                          struct decompress_stats *stats)
+{
+    struct decompress_reader r;
+
+    if (data == NULL || out_data == NULL || out_size == NULL ||
+        (prefix == NULL && prefix_size != 0))
+    {
+        return -1;
+    }
+
+    decompress_reader_init(&r, prefix, prefix_size, data, size);
+
+    switch (mode)
+    {
+        case COMPRESS_ZX0:
+            decompress_zx0(&r);
+            break;
+
+        case COMPRESS_ZX7:
+            decompress_zx7(&r);
+            break;
+
+        default:
+            r.error = true;
+            break;
+    }
+
+    return decompress_finish(&r, out_data, out_size, stats);
+}
+
+int decompress_array(const uint8_t *data,
+                     size_t size,
+                     compress_mode_t mode,
+                     uint8_t **out_data,
+                     size_t *out_size)
+{
+    return decompress_run(NULL, 0, data, size, mode, out_data, out_size, NULL);
+}
+
+/*
+ * Decodes a stream compressed with a prefix window. The prefix must be the
+ * same bytes the compressor saw directly before the data.
+ */
+int decompress_array_prefix(const uint8_t *prefix,
+                            size_t prefix_size,
+                            const uint8_t *data,
+                            size_t size,
+                            compress_mode_t mode,
+                            uint8_t **out_data,
+                            size_t *out_size)
+{
+    return decompress_run(prefix, prefix_size, data, size, mode, out_data, out_size, NULL);
+}
+
+static unsigned long decompress_cycles(const struct decompress_stats *stats, compress_mode_t mode)
+{
+    const struct decompress_cost *cost;
+
+    if (stats == NULL)
+    {
+        return 0;
+    }
+
+    cost = mode == COMPRESS_ZX0 ? &decompress_zx0_cost : &decompress_zx7_cost;
+
+    return (unsigned long)stats->nr_bits * cost->bit +
+           (unsigned long)stats->nr_bit_bytes * cost->bit_byte +
+           (unsigned long)stats->nr_literals * cost->literal +
+           (unsigned long)stats->nr_literal_runs * cost->literal_run +
+           (unsigned long)stats->nr_matches * cost->match +
+           (unsigned long)stats->nr_new_offsets * cost->new_offset +
+           (unsigned long)stats->nr_match_bytes * cost->match_byte;
+}
+
+/*
+ * Decodes a stream only to count its tokens, and returns the estimated eZ80
+ * cycles needed to decompress it on the calculator. The prefix is what the
+ * stream was compressed against, as with decompress_array_prefix.
+ */
+int decompress_estimate_cycles(const uint8_t *prefix,
+                               size_t prefix_size,
+                               const uint8_t *data,
+                               size_t size,
+                               compress_mode_t mode,
+                               unsigned long *cycles)
+{
+    struct decompress_stats stats;
+    uint8_t *out_data;
+    size_t out_size;
+    int ret;
+
+    if (cycles == NULL)
+    {
+        return -1;
+    }
+
+    ret = decompress_run(prefix, prefix_size, data, size, mode, &out_data, &out_size, &stats);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    free(out_data);
+    *cycles = decompress_cycles(&stats, mode);
+
+    return 0;
+}
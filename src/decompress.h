@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "compress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Token counts gathered while decoding a stream, used to estimate how long
+ * the on-calc decompressor takes to run.
+ */
+struct decompress_stats
+{
+    size_t nr_bits;
+    size_t nr_bit_bytes;
+    size_t nr_literals;
+    size_t nr_literal_runs;
+    size_t nr_matches;
+    size_t nr_new_offsets;
+    size_t nr_match_bytes;
+};
+
+int decompress_array(const uint8_t *data,
+                     size_t size,
+                     compress_mode_t mode,
+                     uint8_t **out_data,
+                     size_t *out_size);
+
+int decompress_array_prefix(const uint8_t *prefix,
+                            size_t prefix_size,
+                            const uint8_t *data,
+                            size_t size,
+                            compress_mode_t mode,
+                            uint8_t **out_data,
+                            size_t *out_size);
+
+int decompress_estimate_cycles(const uint8_t *prefix,
+                               size_t prefix_size,
+                               const uint8_t *data,
+                               size_t size,
+                               compress_mode_t mode,
+                               unsigned long *cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,27 +28,93 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "input.h"
+#include "decompress.h"
 #include "ti8x.h"
 #include "elf.h"
 #include "log.h"
 
 #include <errno.h>
 #include <string.h>
-#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/*
+ * Maps all of fd, file_size bytes, copy-on-write: pages are only copied
+ * when written to. Returns NULL if the file cannot be mapped.
+ */
+static void *input_map(FILE *fd, size_t file_size)
+{
+#ifdef _WIN32
+    HANDLE mapping;
+    void *map;
+
+    mapping = CreateFileMappingA((HANDLE)_get_osfhandle(_fileno(fd)),
+        NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        return NULL;
+    }
+
+    /* the view keeps the mapping open */
+    map = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, file_size);
+    CloseHandle(mapping);
+
+    return map;
+#else
+    void *map;
+
+    map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fd), 0);
+
+    return map == MAP_FAILED ? NULL : map;
+#endif
+}
+
+static void input_unmap(void *map, size_t map_size)
+{
+#ifdef _WIN32
+    (void)map_size;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, map_size);
+#endif
+}
+
+static void input_release_range(uint8_t *data, void *map, size_t map_size)
+{
+    if (map != NULL)
+    {
+        input_unmap(map, map_size);
+    }
+    else
+    {
+        free(data);
+    }
+}
 
 static int input_read_range(FILE *fd,
                             size_t offset,
                             size_t strip_end_bytes,
                             uint8_t **data,
-                            size_t *size)
+                            size_t *size,
+                            void **map,
+                            size_t *map_size)
 {
     long file_size_long;
     size_t file_size;
     size_t read_size;
     uint8_t *buffer;
 
-    if (fd == NULL || data == NULL || size == NULL)
+    if (fd == NULL || data == NULL || size == NULL || map == NULL || map_size == NULL)
     {
         LOG_ERROR("Invalid param in '%s'.\n", __func__);
         return -1;
@@ -77,6 +143,19 @@ static int input_read_range(FILE *fd,
 
     read_size = file_size - offset - strip_end_bytes;
 
+    /* small inputs are cheaper to read than to map */
+    if (read_size >= INPUT_MAP_MIN_SIZE)
+    {
+        *map = input_map(fd, file_size);
+        if (*map != NULL)
+        {
+            *map_size = file_size;
+            *data = (uint8_t *)*map + offset;
+            *size = read_size;
+            return 0;
+        }
+    }
+
     buffer = malloc(read_size == 0 ? 1 : read_size);
     if (buffer == NULL)
     {
@@ -104,132 +183,459 @@ static int input_read_range(FILE *fd,
     return 0;
 }
 
-static int input_bin(FILE *fd, uint8_t **data, size_t *size, size_t offset)
+static int input_bin(FILE *fd, struct input_file *file, size_t offset)
 {
-    return input_read_range(fd, offset, 0, data, size);
+    return input_read_range(fd, offset, 0, &file->data, &file->size, &file->map, &file->map_size);
 }
 
-static int input_ti8x(FILE *fd, uint8_t **data, size_t *size, size_t offset)
+static int input_ti8x(FILE *fd, struct input_file *file, size_t offset)
 {
-    return input_read_range(fd, offset, TI8X_CHECKSUM_LEN, data, size);
+    return input_read_range(fd, offset, TI8X_CHECKSUM_LEN, &file->data, &file->size, &file->map, &file->map_size);
 }
 
-static char *input_csv_line(FILE *fd)
+/* field classes for the csv scanner; digits map to their value */
+#define INPUT_CSV_OTH 0x10
+#define INPUT_CSV_SPC 0x20
+#define INPUT_CSV_SEP 0x40
+#define OTH INPUT_CSV_OTH
+#define SPC INPUT_CSV_SPC
+#define SEP INPUT_CSV_SEP
+
+static const uint8_t input_csv_class[256] =
 {
-    char *line = NULL;
-    int i = 0;
-    int c;
+    SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP,
+    SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP, SEP,
+    SPC, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, SEP, OTH, OTH, OTH,
+      0,   1,   2,   3,   4,   5,   6,   7,   8,   9, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH,  10,  11,  12,  13,  14,  15, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH,  10,  11,  12,  13,  14,  15, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH,
+};
+
+#undef OTH
+#undef SPC
+#undef SEP
 
-    do
+/*
+ * Spaces are dropped anywhere in a field, so "0 x1F" reads as 0x1F.
+ */
+static const uint8_t *input_csv_skip(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && input_csv_class[*p] == INPUT_CSV_SPC)
     {
-        c = fgetc(fd);
+        p++;
+    }
 
-        if (c < ' ')
-        {
-            c = 0;
-        }
+    return p;
+}
 
-        if (!isspace((unsigned char)c))
+/*
+ * Parses the field at p like strtol(field, NULL, 0), plus 0b binary.
+ * Negative and out of range values become 255 and a field without digits
+ * is 0. Returns the position of the separator ending the field.
+ */
+static const uint8_t *input_csv_field(const uint8_t *p, const uint8_t *end, uint8_t *value)
+{
+    unsigned int number = 0;
+    unsigned int base = 10;
+    bool negative = false;
+    bool digits = false;
+
+    if (*p == '-' || *p == '+')
+    {
+        negative = *p == '-';
+        p = input_csv_skip(p + 1, end);
+    }
+
+    if (p < end && *p == '0')
+    {
+        const uint8_t *prefix = input_csv_skip(p + 1, end);
+
+        digits = true;
+        base = 8;
+        p = prefix;
+
+        if (prefix < end)
         {
-#define REALLOC_BYTES 512
-            if (i % REALLOC_BYTES == 0)
+            const uint8_t *first = input_csv_skip(prefix + 1, end);
+
+            if (first < end)
             {
-                void *tmp = line;
-                line = realloc(tmp, ((i / REALLOC_BYTES) + 1) * REALLOC_BYTES);
-                if (line == NULL)
+                if ((*prefix == 'x' || *prefix == 'X') && input_csv_class[*first] < 16)
                 {
-                    LOG_ERROR("Memory error in '%s'.\n", __func__);
-                    free(tmp);
-                    return NULL;
+                    base = 16;
+                    p = first;
+                }
+                else if ((*prefix == 'b' || *prefix == 'B') && input_csv_class[*first] < 2)
+                {
+                    base = 2;
+                    p = first;
                 }
             }
-#undef REALLOC_BYTES
-            line[i] = (char)c;
-            i++;
         }
-    } while (c);
+    }
+
+    for (; p < end; ++p)
+    {
+        unsigned int digit = input_csv_class[*p];
+
+        if (digit == INPUT_CSV_SPC)
+        {
+            continue;
+        }
+
+        if (digit >= base)
+        {
+            break;
+        }
+
+        number = number * base + digit;
+        if (number > 255)
+        {
+            number = 256;
+        }
+
+        digits = true;
+    }
+
+    while (p < end && input_csv_class[*p] != INPUT_CSV_SEP)
+    {
+        p++;
+    }
+
+    if (!digits)
+    {
+        *value = 0;
+    }
+    else
+    {
+        *value = (uint8_t)(number > 255 || (negative && number != 0) ? 255 : number);
+    }
 
-    return line;
+    return p;
 }
 
-static int input_csv(FILE *fd, uint8_t **data, size_t *size)
+/*
+ * Parses the fields in [*pos, end) into up to max_size values, leaving
+ * *pos at the first field not parsed.
+ */
+static size_t input_csv_scan(const uint8_t **pos, const uint8_t *end, uint8_t *data, size_t max_size)
 {
+    const uint8_t *p = *pos;
     size_t s = 0;
-    size_t cap = 512;
-    uint8_t *buffer;
 
-    if (data == NULL || size == NULL)
+    while (p < end && s < max_size)
     {
-        LOG_ERROR("Invalid param in '%s'.\n", __func__);
-        return -1;
+        unsigned int c = input_csv_class[*p];
+
+        if (c == INPUT_CSV_SEP || c == INPUT_CSV_SPC)
+        {
+            p++;
+            continue;
+        }
+
+        p = input_csv_field(p, end, &data[s++]);
     }
 
-    buffer = malloc(cap);
-    if (buffer == NULL)
+    *pos = p;
+
+    return s;
+}
+
+static int input_csv_init(struct input_csv *csv, FILE *fd)
+{
+    csv->fd = fd;
+    csv->buffer = malloc(INPUT_CSV_CHUNK_SIZE);
+    csv->capacity = INPUT_CSV_CHUNK_SIZE;
+    csv->start = 0;
+    csv->limit = 0;
+    csv->end = 0;
+    csv->eof = false;
+
+    if (csv->buffer == NULL)
     {
         LOG_ERROR("Memory error in '%s'.\n", __func__);
         return -1;
     }
 
-    do
+    return 0;
+}
+
+/*
+ * Reads the next block of the file after what is left unparsed. Only the
+ * fields before limit, the last separator read, are known to be complete;
+ * the buffer grows if a single field fills all of it.
+ */
+static int input_csv_fill(struct input_csv *csv)
+{
+    size_t count;
+
+    if (csv->start != 0)
     {
-        char *token;
-        char *line;
+        memmove(csv->buffer, csv->buffer + csv->start, csv->end - csv->start);
+        csv->end -= csv->start;
+        csv->start = 0;
+    }
+
+    if (csv->end == csv->capacity)
+    {
+        uint8_t *tmp;
+
+        if (csv->capacity > SIZE_MAX / 2)
+        {
+            LOG_ERROR("CSV input too large.\n");
+            return -1;
+        }
 
-        line = input_csv_line(fd);
-        if (line == NULL)
+        tmp = realloc(csv->buffer, csv->capacity * 2);
+        if (tmp == NULL)
         {
-            free(buffer);
+            LOG_ERROR("Memory error in '%s'.\n", __func__);
             return -1;
         }
 
-        token = strtok(line, ",");
+        csv->buffer = tmp;
+        csv->capacity *= 2;
+    }
 
-        while (token)
+    count = fread(csv->buffer + csv->end, 1, csv->capacity - csv->end, csv->fd);
+    if (count == 0)
+    {
+        if (ferror(csv->fd))
         {
-            long int value = strtol(token, NULL, 0);
+            LOG_ERROR("Input read failed.\n");
+            return -1;
+        }
 
-            if (s == cap)
-            {
-                size_t next_cap;
-                uint8_t *tmp;
+        csv->eof = true;
+    }
 
-                if (cap > SIZE_MAX / 2)
-                {
-                    LOG_ERROR("CSV input too large.\n");
-                    free(line);
-                    free(buffer);
-                    return -1;
-                }
-                next_cap = cap * 2;
+    csv->end += count;
 
-                tmp = realloc(buffer, next_cap);
-                if (tmp == NULL)
-                {
-                    LOG_ERROR("Memory error in '%s'.\n", __func__);
-                    free(line);
-                    free(buffer);
-                    return -1;
-                }
+    if (csv->eof)
+    {
+        csv->limit = csv->end;
+    }
+    else
+    {
+        csv->limit = csv->end;
+        while (csv->limit > 0 && input_csv_class[csv->buffer[csv->limit - 1]] != INPUT_CSV_SEP)
+        {
+            csv->limit--;
+        }
+    }
+
+    return 0;
+}
+
+int input_csv_open(struct input_csv *csv, const char *name)
+{
+    FILE *fd;
+
+    fd = fopen(name, "rb");
+    if (fd == NULL)
+    {
+        LOG_ERROR("Cannot open input file '%s': %s\n",
+            name,
+            strerror(errno));
+        return -1;
+    }
+
+    if (input_csv_init(csv, fd) != 0)
+    {
+        fclose(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int input_csv_read(struct input_csv *csv, uint8_t *data, size_t max_size, size_t *size)
+{
+    size_t s = 0;
 
-                buffer = tmp;
-                cap = next_cap;
+    while (s < max_size)
+    {
+        const uint8_t *p = csv->buffer + csv->start;
+
+        if (csv->start == csv->limit)
+        {
+            if (csv->eof)
+            {
+                break;
             }
 
-            buffer[s++] = (uint8_t)(value < 0 || value > 255 ? 255 : value);
+            if (input_csv_fill(csv) != 0)
+            {
+                return -1;
+            }
 
-            token = strtok(NULL, ",");
+            continue;
         }
 
-        free(line);
-    } while (!feof(fd));
+        s += input_csv_scan(&p, csv->buffer + csv->limit, data + s, max_size - s);
+        csv->start = (size_t)(p - csv->buffer);
+    }
 
-    *data = buffer;
     *size = s;
 
     return 0;
 }
 
+void input_csv_close(struct input_csv *csv)
+{
+    free(csv->buffer);
+    csv->buffer = NULL;
+
+    if (csv->fd != NULL)
+    {
+        fclose(csv->fd);
+        csv->fd = NULL;
+    }
+}
+
+/*
+ * Parses the whole file. Fields are at least one byte apart, so the file
+ * size bounds the number of values.
+ */
+static int input_csv(FILE *fd, uint8_t **data, size_t *size)
+{
+    struct input_csv csv;
+    long file_size;
+    size_t max_size;
+    uint8_t *buffer;
+    int ret;
+
+    if (data == NULL || size == NULL)
+    {
+        LOG_ERROR("Invalid param in '%s'.\n", __func__);
+        return -1;
+    }
+
+    if (fseek(fd, 0, SEEK_END) != 0)
+    {
+        LOG_ERROR("Input seek failed.\n");
+        return -1;
+    }
+
+    file_size = ftell(fd);
+    if (file_size < 0 || fseek(fd, 0, SEEK_SET) != 0)
+    {
+        LOG_ERROR("Input seek failed.\n");
+        return -1;
+    }
+
+    max_size = (size_t)file_size / 2 + 1;
+
+    buffer = malloc(max_size);
+    if (buffer == NULL)
+    {
+        LOG_ERROR("Memory error in '%s'.\n", __func__);
+        return -1;
+    }
+
+    ret = input_csv_init(&csv, fd);
+    if (ret == 0)
+    {
+        ret = input_csv_read(&csv, buffer, max_size, size);
+    }
+
+    /* the caller closes fd */
+    free(csv.buffer);
+
+    if (ret != 0)
+    {
+        free(buffer);
+        return ret;
+    }
+
+    *data = buffer;
+
+    return 0;
+}
+
+/*
+ * Counts the values in the file without parsing them, for inputs that are
+ * streamed to the output later. Every field holds exactly one value.
+ */
+static int input_csv_count(FILE *fd, size_t *size)
+{
+    uint8_t *buffer;
+    unsigned int field = 0;
+    size_t count = 0;
+    size_t n;
+
+    buffer = malloc(INPUT_CSV_CHUNK_SIZE);
+    if (buffer == NULL)
+    {
+        LOG_ERROR("Memory error in '%s'.\n", __func__);
+        return -1;
+    }
+
+    while ((n = fread(buffer, 1, INPUT_CSV_CHUNK_SIZE, fd)) != 0)
+    {
+        size_t i;
+
+        /* a field starts at its first character that is not a space */
+        for (i = 0; i < n; ++i)
+        {
+            unsigned int c = input_csv_class[buffer[i]];
+            unsigned int value = (c & (INPUT_CSV_SEP | INPUT_CSV_SPC)) == 0;
+
+            count += value & (field ^ 1);
+            field = (field | value) & (c != INPUT_CSV_SEP);
+        }
+    }
+
+    if (ferror(fd))
+    {
+        LOG_ERROR("Input read failed.\n");
+        free(buffer);
+        return -1;
+    }
+
+    free(buffer);
+
+    *size = count;
+
+    return 0;
+}
+
+static int input_compressed(FILE *fd, uint8_t **data, size_t *size, compress_mode_t mode)
+{
+    uint8_t *compressed_data;
+    size_t compressed_size;
+    void *map = NULL;
+    size_t map_size = 0;
+    int ret;
+
+    ret = input_read_range(fd, 0, 0, &compressed_data, &compressed_size, &map, &map_size);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    ret = decompress_array(compressed_data, compressed_size, mode, data, size);
+    if (ret != 0)
+    {
+        LOG_ERROR("Input is not a valid %s stream.\n",
+            mode == COMPRESS_ZX0 ? "zx0" : "zx7");
+    }
+
+    input_release_range(compressed_data, map, map_size);
+
+    return ret;
+}
+
 static int input_elf(FILE *fd,
                      uint8_t **data,
                      size_t *size,
@@ -238,24 +644,50 @@ static int input_elf(FILE *fd,
     return elf_extract_binary(fd, data, size, reloc_table);
 }
 
-int input_read_file(struct input_file *file)
+void input_free_file(struct input_file *file)
 {
-    FILE *fd;
-    int ret;
-
-    if (file->data != NULL)
+    if (file->map != NULL)
+    {
+        input_unmap(file->map, file->map_size);
+        file->map = NULL;
+        file->map_size = 0;
+    }
+    else
     {
         free(file->data);
-        file->data = NULL;
-        file->size = 0;
     }
 
+    file->data = NULL;
+    file->size = 0;
+
     if (file->reloc_table.data != NULL)
     {
         free(file->reloc_table.data);
         file->reloc_table.data = NULL;
         file->reloc_table.size = 0;
     }
+}
+
+/*
+ * Replaces the file's data with data, which the file then owns, releasing
+ * the old data or mapping.
+ */
+void input_set_data(struct input_file *file, uint8_t *data, size_t size)
+{
+    input_release_range(file->data, file->map, file->map_size);
+
+    file->map = NULL;
+    file->map_size = 0;
+    file->data = data;
+    file->size = size;
+}
+
+int input_read_file(struct input_file *file)
+{
+    FILE *fd;
+    int ret;
+
+    input_free_file(file);
 
     fd = fopen(file->name, "rb");
     if (fd == NULL)
@@ -269,45 +701,56 @@ int input_read_file(struct input_file *file)
     switch (file->format)
     {
         case IFORMAT_BIN:
-            ret = input_bin(fd, &file->data, &file->size, 0);
+            ret = input_bin(fd, file, 0);
             break;
 
         case IFORMAT_TI8X_DATA:
-            ret = input_ti8x(fd, &file->data, &file->size, TI8X_DATA);
+            ret = input_ti8x(fd, file, TI8X_DATA);
             break;
 
         case IFORMAT_TI8X_DATA_VAR:
-            ret = input_ti8x(fd, &file->data, &file->size, TI8X_VAR_HEADER);
+            ret = input_ti8x(fd, file, TI8X_VAR_HEADER);
             break;
 
         case IFORMAT_TI8EK:
-            ret = input_bin(fd, &file->data, &file->size, TI8EK_APP_HEADER_OFFSET);
+            ret = input_bin(fd, file, TI8EK_APP_HEADER_OFFSET);
             break;
 
         case IFORMAT_CSV:
-            ret = input_csv(fd, &file->data, &file->size);
+            if (file->stream)
+            {
+                ret = input_csv_count(fd, &file->size);
+            }
+            else
+            {
+                ret = input_csv(fd, &file->data, &file->size);
+            }
             break;
 
         case IFORMAT_ELF:
             ret = input_elf(fd, &file->data, &file->size, &file->reloc_table);
             break;
 
+        case IFORMAT_ZX0:
+            ret = input_compressed(fd, &file->data, &file->size, COMPRESS_ZX0);
+            break;
+
+        case IFORMAT_ZX7:
+            ret = input_compressed(fd, &file->data, &file->size, COMPRESS_ZX7);
+            break;
+
         default:
             LOG_ERROR("Unknown input format.\n");
             ret = -1;
             break;
     }
 
+    /* a mapping stays valid after the file is closed */
     fclose(fd);
 
     if (ret != 0)
     {
-        if (file->data != NULL)
-        {
-            free(file->data);
-            file->data = NULL;
-            file->size = 0;
-        }
+        input_free_file(file);
     }
 
     return ret;
@@ -317,19 +760,40 @@ int input_add_file_path(struct input *input, const char *path)
 {
     struct input_file *f;
 
-    if (input->nr_files >= INPUT_MAX_NUM)
+    /* the list doubles as it fills, so its size follows the input count */
+    if (input->nr_files == input->max_files)
     {
-        LOG_ERROR("Too many input files.\n");
-        return -1;
+        uint32_t max_files = input->max_files == 0 ? 16 : input->max_files * 2;
+        struct input_file *files;
+
+        if (max_files < input->max_files || SIZE_MAX / max_files < sizeof(struct input_file))
+        {
+            LOG_ERROR("Too many input files.\n");
+            return -1;
+        }
+
+        files = realloc(input->files, max_files * sizeof(struct input_file));
+        if (files == NULL)
+        {
+            LOG_ERROR("Memory error in '%s'.\n", __func__);
+            return -1;
+        }
+
+        input->files = files;
+        input->max_files = max_files;
     }
 
     f = &input->files[input->nr_files];
 
     f->name = path;
+    f->owned_name = NULL;
     f->format = input->default_format;
     f->compression = input->default_compression;
     f->size = 0;
     f->data = NULL;
+    f->map = NULL;
+    f->map_size = 0;
+    f->stream = false;
     f->reloc_table.data = NULL;
     f->reloc_table.size = 0;
     f->reloc_table.init_offset = 0;
@@ -349,20 +813,16 @@ void input_free_files(struct input *input)
         return;
     }
 
+    input_free_file(&input->dict);
+
     for (i = 0; i < input->nr_files; ++i)
     {
-        if (input->files[i].data != NULL)
-        {
-            free(input->files[i].data);
-            input->files[i].data = NULL;
-            input->files[i].size = 0;
-        }
-
-        if (input->files[i].reloc_table.data != NULL)
-        {
-            free(input->files[i].reloc_table.data);
-            input->files[i].reloc_table.data = NULL;
-            input->files[i].reloc_table.size = 0;
-        }
+        input_free_file(&input->files[i]);
+        free(input->files[i].owned_name);
     }
+
+    free(input->files);
+    input->files = NULL;
+    input->nr_files = 0;
+    input->max_files = 0;
 }
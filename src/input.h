@@ -34,6 +34,7 @@
 #include "elf.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,7 +42,9 @@ extern "C" {
 
 #include "compress.h"
 
-#define INPUT_MAX_NUM 256
+#define INPUT_MAX_JOBS 256
+#define INPUT_MAP_MIN_SIZE 65536
+#define INPUT_CSV_CHUNK_SIZE 65536
 
 typedef enum
 {
@@ -51,33 +54,82 @@ typedef enum
     IFORMAT_TI8EK,
     IFORMAT_CSV,
     IFORMAT_ELF,
+    IFORMAT_ZX0,
+    IFORMAT_ZX7,
     IFORMAT_INVALID,
 } iformat_t;
 
+/*
+ * Inputs of at least INPUT_MAP_MIN_SIZE bytes read as-is (bin, 8x and 8ek)
+ * are mapped instead of read into a buffer. data then points into a private
+ * mapping of the whole file, map, which is shared with the page cache until
+ * a stage writes to it, so data may be modified in place either way.
+ *
+ * CSV inputs with stream set are only counted when read: size is the
+ * number of values and data stays NULL. The values are parsed again with
+ * input_csv_read() when written out.
+ *
+ * owned_name is set when name was allocated for the file, as for inputs
+ * listed in a response file, and is freed with the input list.
+ */
 struct input_file
 {
     const char *name;
+    char *owned_name;
     iformat_t format;
     compress_mode_t compression;
     size_t size;
     uint8_t *data;
+    void *map;
+    size_t map_size;
+    bool stream;
     struct app_reloc_table reloc_table;
 };
 
+/*
+ * Parses a CSV file a block at a time, so memory use does not depend on
+ * the file size.
+ */
+struct input_csv
+{
+    FILE *fd;
+    uint8_t *buffer;
+    size_t capacity;
+    size_t start;
+    size_t limit;
+    size_t end;
+    bool eof;
+};
+
 struct input
 {
     uint32_t nr_files;
+    uint32_t max_files;
     iformat_t default_format;
     compress_mode_t default_compression;
-    struct input_file files[INPUT_MAX_NUM];
+    uint32_t nr_jobs;
+    bool compress_chain;
+    struct compress_options compress_options;
+    struct input_file dict;
+    struct input_file *files;
 };
 
 int input_read_file(struct input_file *file);
 
 int input_add_file_path(struct input *input, const char *path);
 
+void input_free_file(struct input_file *file);
+
+void input_set_data(struct input_file *file, uint8_t *data, size_t size);
+
 void input_free_files(struct input *input);
 
+int input_csv_open(struct input_csv *csv, const char *name);
+
+int input_csv_read(struct input_csv *csv, uint8_t *data, size_t max_size, size_t *size);
+
+void input_csv_close(struct input_csv *csv);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,7 +28,16 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "log.h"
+#include "thread.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
 
 const char *log_strings[] =
 {
@@ -41,7 +50,142 @@ const char *log_strings[] =
 
 log_level_t log_level;
 
+static struct
+{
+    bool enabled;
+    struct thread_key key;
+} log_capture_state;
+
 void log_set_level(log_level_t level)
 {
     log_level = level;
 }
+
+static int log_buffer_reserve(struct log_buffer *buffer, size_t size)
+{
+    size_t capacity;
+    char *data;
+
+    if (buffer->capacity - buffer->size >= size)
+    {
+        return 0;
+    }
+
+    capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity - buffer->size < size)
+    {
+        capacity *= 2;
+    }
+
+    data = realloc(buffer->data, capacity);
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+
+    return 0;
+}
+
+/*
+ * Appends to the calling thread's capture buffer if it has one, or prints.
+ * A message that cannot be buffered is printed rather than lost.
+ */
+void log_printf(const char *fmt, ...)
+{
+    struct log_buffer *buffer = NULL;
+    va_list args;
+
+    if (log_capture_state.enabled)
+    {
+        buffer = thread_key_get(&log_capture_state.key);
+    }
+
+    if (buffer != NULL)
+    {
+        int len;
+
+        va_start(args, fmt);
+        len = vsnprintf(NULL, 0, fmt, args);
+        va_end(args);
+
+        if (len >= 0 && log_buffer_reserve(buffer, (size_t)len + 1) == 0)
+        {
+            va_start(args, fmt);
+            vsnprintf(buffer->data + buffer->size, (size_t)len + 1, fmt, args);
+            va_end(args);
+            buffer->size += (size_t)len;
+            return;
+        }
+    }
+
+    va_start(args, fmt);
+    vfprintf(stdout, fmt, args);
+    va_end(args);
+    fflush(stdout);
+}
+
+int log_capture_init(void)
+{
+    if (log_capture_state.enabled)
+    {
+        return 0;
+    }
+
+    if (thread_key_init(&log_capture_state.key) != 0)
+    {
+        return -1;
+    }
+
+    log_capture_state.enabled = true;
+
+    return 0;
+}
+
+void log_capture_free(void)
+{
+    if (!log_capture_state.enabled)
+    {
+        return;
+    }
+
+    thread_key_destroy(&log_capture_state.key);
+    log_capture_state.enabled = false;
+}
+
+void log_capture(struct log_buffer *buffer)
+{
+    if (log_capture_state.enabled)
+    {
+        thread_key_set(&log_capture_state.key, buffer);
+    }
+}
+
+void log_buffer_init(struct log_buffer *buffer)
+{
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+/*
+ * Prints everything captured in buffer and empties it.
+ */
+void log_buffer_flush(struct log_buffer *buffer)
+{
+    if (buffer->size > 0)
+    {
+        fwrite(buffer->data, 1, buffer->size, stdout);
+        fflush(stdout);
+    }
+
+    log_buffer_free(buffer);
+}
+
+void log_buffer_free(struct log_buffer *buffer)
+{
+    free(buffer->data);
+    log_buffer_init(buffer);
+}
@@ -31,6 +31,7 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stddef.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -57,8 +58,7 @@ extern const char *log_strings[];
 do { \
     if (level <= LOG_BUILD_LEVEL && level <= log_level) \
     { \
-        fprintf(stdout, "[%s] " fmt, log_strings[level], ##__VA_ARGS__); \
-        fflush(stdout); \
+        log_printf("[%s] " fmt, log_strings[level], ##__VA_ARGS__); \
     } \
 } while(0)
 
@@ -72,13 +72,39 @@ do { \
     if (LOG_LVL_INFO <= LOG_BUILD_LEVEL && \
         LOG_LVL_INFO <= log_level) \
     { \
-        fprintf(stdout, fmt, ##__VA_ARGS__); \
-        fflush(stdout); \
+        log_printf(fmt, ##__VA_ARGS__); \
     } \
 } while(0)
 
+/*
+ * Messages logged by a thread that is capturing are appended to its buffer
+ * instead of being printed, so work done on several threads can be reported
+ * in a fixed order. Capturing must be initialized before any thread starts
+ * capturing and freed after they have all stopped.
+ */
+struct log_buffer
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
 void log_set_level(log_level_t level);
 
+void log_printf(const char *fmt, ...);
+
+int log_capture_init(void);
+
+void log_capture_free(void);
+
+void log_capture(struct log_buffer *buffer);
+
+void log_buffer_init(struct log_buffer *buffer);
+
+void log_buffer_flush(struct log_buffer *buffer);
+
+void log_buffer_free(struct log_buffer *buffer);
+
 #ifdef __cplusplus
 }
 #endif
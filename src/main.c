@@ -29,6 +29,7 @@
  */
 
 #include "options.h"
+#include "cache.h"
 #include "convert.h"
 #include "input.h"
 #include "output.h"
@@ -43,7 +44,16 @@ int main(int argc, char *argv[])
     ret = options_get(argc, argv, &options);
     if (ret == OPTIONS_SUCCESS)
     {
-        ret = convert_input_to_output(&options.input, &options.output);
+        cache_init(options.cache_dir);
+        if (options.estimate)
+        {
+            ret = convert_estimate(&options.input);
+        }
+        else
+        {
+            ret = convert_input_to_output(&options.input, &options.output);
+        }
+        cache_free();
     }
 
     exit_code = ret == OPTIONS_IGNORE ? 0 : ret;
@@ -0,0 +1,306 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "match.h"
+
+#include <string.h>
+
+void match_index_init(struct match_index *index)
+{
+    memset(index, 0, sizeof *index);
+}
+
+void match_index_free(struct match_index *index)
+{
+    if (index == NULL)
+    {
+        return;
+    }
+
+    free(index->prev_byte);
+    free(index->prev_pair);
+
+    match_index_init(index);
+}
+
+int match_index_build(struct match_index *index, const uint8_t *data, size_t size)
+{
+    int32_t last_byte[256];
+    int32_t *last_pair;
+    size_t i;
+
+    if (index == NULL || data == NULL || size > INT32_MAX)
+    {
+        return -1;
+    }
+
+    if (size > index->capacity)
+    {
+        int32_t *prev_byte;
+        int32_t *prev_pair;
+
+        prev_byte = realloc(index->prev_byte, size * sizeof(int32_t));
+        if (prev_byte == NULL)
+        {
+            return -1;
+        }
+        index->prev_byte = prev_byte;
+
+        prev_pair = realloc(index->prev_pair, size * sizeof(int32_t));
+        if (prev_pair == NULL)
+        {
+            return -1;
+        }
+        index->prev_pair = prev_pair;
+
+        index->capacity = size;
+    }
+
+    last_pair = malloc(256 * 256 * sizeof(int32_t));
+    if (last_pair == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 256; ++i)
+    {
+        last_byte[i] = MATCH_NONE;
+    }
+
+    for (i = 0; i < 256 * 256; ++i)
+    {
+        last_pair[i] = MATCH_NONE;
+    }
+
+    for (i = 0; i < size; ++i)
+    {
+        index->prev_byte[i] = last_byte[data[i]];
+        last_byte[data[i]] = (int32_t)i;
+
+        if (i == 0)
+        {
+            index->prev_pair[i] = MATCH_NONE;
+        }
+        else
+        {
+            unsigned int pair = (unsigned int)data[i - 1] << 8 | data[i];
+
+            index->prev_pair[i] = last_pair[pair];
+            last_pair[pair] = (int32_t)i;
+        }
+    }
+
+    free(last_pair);
+
+    index->data = data;
+    index->size = size;
+
+    return 0;
+}
+
+void match_probe_init(struct match_probe *probe)
+{
+    memset(probe, 0, sizeof *probe);
+}
+
+void match_probe_free(struct match_probe *probe)
+{
+    if (probe == NULL)
+    {
+        return;
+    }
+
+    free(probe->heads);
+
+    match_probe_init(probe);
+}
+
+/*
+ * Starts a new buffer. Both tables are sized to the data, up to
+ * MATCH_PROBE_HASH_BITS, so that small blocks do not pay for clearing them.
+ */
+int match_probe_reset(struct match_probe *probe, const uint8_t *data, size_t size)
+{
+    unsigned int hash_bits = 8;
+    size_t entries;
+    size_t i;
+
+    if (probe == NULL || data == NULL || size > INT32_MAX)
+    {
+        return -1;
+    }
+
+    while (hash_bits < MATCH_PROBE_HASH_BITS && ((size_t)1 << hash_bits) < size)
+    {
+        hash_bits++;
+    }
+
+    entries = (size_t)2 << hash_bits;
+
+    if (entries > probe->capacity)
+    {
+        int32_t *heads = realloc(probe->heads, entries * sizeof(int32_t));
+        if (heads == NULL)
+        {
+            return -1;
+        }
+        probe->heads = heads;
+        probe->capacity = entries;
+    }
+
+    for (i = 0; i < entries; ++i)
+    {
+        probe->heads[i] = MATCH_NONE;
+    }
+
+    probe->data = data;
+    probe->size = size;
+    probe->next = 0;
+    probe->hash_bits = hash_bits;
+
+    return 0;
+}
+
+static uint32_t match_probe_rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Returns the slots in the probe's tables for the data at pos: the short
+ * head in heads[0], and the long head in heads[1], or MATCH_NONE when fewer
+ * than MATCH_PROBE_LONG bytes are left.
+ */
+static void match_probe_slots(const struct match_probe *probe, size_t pos, size_t slots[2])
+{
+    const uint8_t *p = probe->data + pos;
+    unsigned int shift = 32 - probe->hash_bits;
+    uint32_t value;
+
+    value = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    slots[0] = (size_t)((value * UINT32_C(2654435761)) >> shift);
+
+    if (pos + MATCH_PROBE_LONG <= probe->size)
+    {
+        value = match_probe_rd32(p) * UINT32_C(2246822519) ^ match_probe_rd32(p + 4) * UINT32_C(2654435761);
+        slots[1] = ((size_t)1 << probe->hash_bits) + (size_t)(value >> shift);
+    }
+    else
+    {
+        slots[1] = (size_t)MATCH_NONE;
+    }
+}
+
+/*
+ * Finds the longest match for the data at pos among the most recent earlier
+ * positions sharing its first MATCH_PROBE_SHORT and first MATCH_PROBE_LONG
+ * bytes, as far as their hashes tell, first adding every position passed
+ * since the last call. pos must not go back between calls. Matches may
+ * overlap pos and are at most length_limit long. Returns the length, or 0
+ * if there is none, and sets offset to the offset giving it.
+ */
+size_t match_probe_longest(struct match_probe *probe,
+                           size_t pos,
+                           size_t offset_limit,
+                           size_t length_limit,
+                           size_t *offset)
+{
+    const uint8_t *data = probe->data;
+    size_t slots[2];
+    size_t best = 0;
+    int i;
+
+    if (pos + MATCH_PROBE_SHORT > probe->size)
+    {
+        return 0;
+    }
+
+    for (; probe->next < pos; probe->next++)
+    {
+        match_probe_slots(probe, probe->next, slots);
+        probe->heads[slots[0]] = (int32_t)probe->next;
+        if (slots[1] != (size_t)MATCH_NONE)
+        {
+            probe->heads[slots[1]] = (int32_t)probe->next;
+        }
+    }
+
+    if (length_limit > probe->size - pos)
+    {
+        length_limit = probe->size - pos;
+    }
+
+    match_probe_slots(probe, pos, slots);
+
+    /* the long head first, as it is the likelier to give the longer match */
+    for (i = 1; i >= 0 && best < length_limit; --i)
+    {
+        int32_t match;
+        const uint8_t *src;
+        size_t len = 0;
+
+        if (slots[i] == (size_t)MATCH_NONE)
+        {
+            continue;
+        }
+
+        match = probe->heads[slots[i]];
+        if (match == MATCH_NONE || (size_t)match >= pos || pos - (size_t)match > offset_limit)
+        {
+            continue;
+        }
+
+        src = data + match;
+
+        /* cannot beat the best unless it also matches the byte after it */
+        if (best > 0 && src[best] != data[pos + best])
+        {
+            continue;
+        }
+
+        while (len + 8 <= length_limit && memcmp(src + len, data + pos + len, 8) == 0)
+        {
+            len += 8;
+        }
+
+        while (len < length_limit && src[len] == data[pos + len])
+        {
+            len++;
+        }
+
+        if (len > best && len >= 2)
+        {
+            best = len;
+            *offset = pos - (size_t)match;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MATCH_NONE (-1)
+#define MATCH_PROBE_HASH_BITS 16
+#define MATCH_PROBE_SHORT 3
+#define MATCH_PROBE_LONG 8
+#define MATCH_PROBE_SKIP_SHIFT 5
+
+/*
+ * Candidate match positions for one input buffer, for the optimal zx0
+ * parser. For every position it links the previous position holding the
+ * same byte, and the previous position ending the same two bytes, so each
+ * chain lists candidates nearest first. An index is never modified once
+ * built, so any number of threads may read it at the same time.
+ */
+struct match_index
+{
+    const uint8_t *data;
+    size_t size;
+    int32_t *prev_byte;
+    int32_t *prev_pair;
+    size_t capacity;
+};
+
+/*
+ * Shallow match finder for the --compress-fast parsers. It keeps two hash
+ * heads, the last position starting with the same MATCH_PROBE_SHORT bytes
+ * and the last starting with the same MATCH_PROBE_LONG bytes, so each lookup
+ * checks at most two candidates: a near one and a long one. Positions are
+ * added as the parse moves forward, so nothing is built up front and the
+ * cost per byte is fixed. Parsers step over more bytes between lookups the
+ * longer they go without a match, one more per 1 << MATCH_PROBE_SKIP_SHIFT
+ * misses, so incompressible data is passed over quickly. A probe is written
+ * to by every lookup, so each thread needs its own.
+ */
+struct match_probe
+{
+    const uint8_t *data;
+    size_t size;
+    size_t next;
+    unsigned int hash_bits;
+    int32_t *heads;
+    size_t capacity;
+};
+
+void match_index_init(struct match_index *index);
+
+void match_index_free(struct match_index *index);
+
+int match_index_build(struct match_index *index, const uint8_t *data, size_t size);
+
+void match_probe_init(struct match_probe *probe);
+
+void match_probe_free(struct match_probe *probe);
+
+int match_probe_reset(struct match_probe *probe, const uint8_t *data, size_t size);
+
+size_t match_probe_longest(struct match_probe *probe,
+                           size_t pos,
+                           size_t offset_limit,
+                           size_t length_limit,
+                           size_t *offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -29,15 +29,34 @@
  */
 
 #include "options.h"
+#include "cache.h"
 #include "output.h"
 #include "input.h"
 #include "log.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <string.h>
 #include <stdlib.h>
 
+enum
+{
+    OPTION_JOBS = 256,
+    OPTION_CACHE_DIR,
+    OPTION_COMPRESS_LEVEL,
+    OPTION_COMPRESS_FORCE,
+    OPTION_COMPRESS_MEM_LIMIT,
+    OPTION_COMPRESS_BLOCKS,
+    OPTION_COMPRESS_BLOCK_SIZE,
+    OPTION_VERIFY,
+    OPTION_COMPRESS_GOAL,
+    OPTION_COMPRESS_DICT,
+    OPTION_COMPRESS_CHAIN,
+    OPTION_COMPRESS_FAST,
+    OPTION_ESTIMATE,
+};
+
 static void options_show(const char *prgm)
 {
     LOG_PRINT("This program is used to convert files to other formats,\n");
@@ -49,6 +68,8 @@ static void options_show(const char *prgm)
     LOG_PRINT("Required parameters:\n");
     LOG_PRINT("    -i, --input <file>         Input file. Can be specified multiple times,\n");
     LOG_PRINT("                               input files are appended in order.\n");
+    LOG_PRINT("                               @<file> reads inputs from <file>, one per\n");
+    LOG_PRINT("                               line, see README.md.\n");
     LOG_PRINT("    -o, --output <file>        Output file after converting.\n");
     LOG_PRINT("    -j, --iformat <mode>       Set per-input file format to <mode>.\n");
     LOG_PRINT("                               See 'Input formats' below.\n");
@@ -69,9 +90,41 @@ static void options_show(const char *prgm)
     LOG_PRINT("                               See 'Compression formats' below.\n");
     LOG_PRINT("    -e, --8xp-compress <mode>  Sets the compression mode for compressed 8xp.\n");
     LOG_PRINT("                               Default is 'zx7'.\n");
+    LOG_PRINT("        --compress-level <n>   Compression effort, 1 (fastest) to 5 (smallest).\n");
+    LOG_PRINT("                               Default is 5.\n");
+    LOG_PRINT("        --compress-goal <goal> What auto mode optimizes for: 'size' (default),\n");
+    LOG_PRINT("                               'speed' for the fastest decompression, or\n");
+    LOG_PRINT("                               'footprint' for data plus decompressor.\n");
+    LOG_PRINT("        --compress-fast        Use a quick greedy parser instead of the\n");
+    LOG_PRINT("                               optimal one. Output is a little larger.\n");
+    LOG_PRINT("        --compress-force       Always run the compressors for compressed 8xp,\n");
+    LOG_PRINT("                               even if the data looks incompressible.\n");
+    LOG_PRINT("        --compress-mem-limit <size>\n");
+    LOG_PRINT("                               Limit zx0 optimizer memory to <size> bytes\n");
+    LOG_PRINT("                               per job, K, M or G suffixes allowed. Uses a\n");
+    LOG_PRINT("                               smaller window instead of failing. Default\n");
+    LOG_PRINT("                               is none.\n");
+    LOG_PRINT("        --compress-blocks      Compress -c/-p data as independent blocks on\n");
+    LOG_PRINT("                               all cores. Adds a block size table, see\n");
+    LOG_PRINT("                               README.md, so not for 8xp outputs.\n");
+    LOG_PRINT("        --compress-block-size <size>\n");
+    LOG_PRINT("                               Block size for --compress-blocks, implies it.\n");
+    LOG_PRINT("                               Default is %u bytes.\n", (unsigned int)COMPRESS_BLOCK_SIZE_DEFAULT);
+    LOG_PRINT("        --compress-dict <file> Prime -c/-p compression with the contents of\n");
+    LOG_PRINT("                               <file>, see README.md for decompression.\n");
+    LOG_PRINT("        --compress-chain       Prime each -p input with the inputs before it.\n");
+    LOG_PRINT("        --verify               Decompress all compressed data and check it\n");
+    LOG_PRINT("                               matches the input.\n");
+    LOG_PRINT("        --estimate             Print the compressed size of each input for\n");
+    LOG_PRINT("                               each codec instead of converting.\n");
     LOG_PRINT("    -m, --maxvarsize <size>    Sets maximum size for the TI 8x* variables.\n");
     LOG_PRINT("    -u, --uppercase            If a program, capitalizes the on-calc name.\n");
     LOG_PRINT("    -a, --append               Append to output file rather than overwrite.\n");
+    LOG_PRINT("        --jobs <count>         Load and compress inputs on up to <count>\n");
+    LOG_PRINT("                               threads. Output is identical to a\n");
+    LOG_PRINT("                               serial run.\n");
+    LOG_PRINT("        --cache-dir <dir>      Cache compressed data in <dir>. Defaults to\n");
+    LOG_PRINT("                               the " CACHE_ENV_DIR " environment variable.\n");
     LOG_PRINT("    -h, --help                 Show this screen.\n");
     LOG_PRINT("    -v, --version              Show the program version.\n");
     LOG_PRINT("    -b, --comment              Custom comment for TI 8x* outputs.\n");
@@ -88,6 +141,8 @@ static void options_show(const char *prgm)
     LOG_PRINT("    elf: Interprets as eZ80 ELF object file.\n");
     LOG_PRINT("    8ek: Interprets as TI 8ek application section.\n");
     LOG_PRINT("    8x:  Interprets as TI 8x* data section.\n");
+    LOG_PRINT("    zx0: Decompresses a raw zx0 stream.\n");
+    LOG_PRINT("    zx7: Decompresses a raw zx7 stream.\n");
     LOG_PRINT("\n");
     LOG_PRINT("Output formats:\n");
     LOG_PRINT("    Below is a list of available output formats, listed as\n");
@@ -148,6 +203,14 @@ static iformat_t options_parse_input_format(const char *str)
     {
         format = IFORMAT_TI8EK;
     }
+    else if (!strcmp(str, "zx0"))
+    {
+        format = IFORMAT_ZX0;
+    }
+    else if (!strcmp(str, "zx7"))
+    {
+        format = IFORMAT_ZX7;
+    }
     else
     {
         format = IFORMAT_INVALID;
@@ -156,6 +219,30 @@ static iformat_t options_parse_input_format(const char *str)
     return format;
 }
 
+static compress_goal_t options_parse_goal(const char *str)
+{
+    compress_goal_t goal;
+
+    if (!strcmp(str, "size"))
+    {
+        goal = COMPRESS_GOAL_SIZE;
+    }
+    else if (!strcmp(str, "speed"))
+    {
+        goal = COMPRESS_GOAL_SPEED;
+    }
+    else if (!strcmp(str, "footprint"))
+    {
+        goal = COMPRESS_GOAL_FOOTPRINT;
+    }
+    else
+    {
+        goal = COMPRESS_GOAL_INVALID;
+    }
+
+    return goal;
+}
+
 static compress_mode_t options_parse_compression(const char *str)
 {
     compress_mode_t compress;
@@ -180,6 +267,72 @@ static compress_mode_t options_parse_compression(const char *str)
     return compress;
 }
 
+/*
+ * Parses a whole string as a number, rejecting empty strings and any
+ * trailing characters.
+ */
+static int options_parse_number(const char *str, long *value)
+{
+    char *end;
+
+    *value = strtol(str, &end, 0);
+    if (end == str || *end != '\0')
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int options_parse_size(const char *str, size_t *size)
+{
+    unsigned long value;
+    unsigned long scale;
+    char *end;
+
+    if (!isdigit((unsigned char)*str))
+    {
+        return -1;
+    }
+
+    value = strtoul(str, &end, 0);
+    switch (toupper((unsigned char)*end))
+    {
+        case '\0':
+            scale = 1;
+            break;
+
+        case 'K':
+            scale = 1024UL;
+            break;
+
+        case 'M':
+            scale = 1024UL * 1024;
+            break;
+
+        case 'G':
+            scale = 1024UL * 1024 * 1024;
+            break;
+
+        default:
+            return -1;
+    }
+
+    if (*end != '\0' && end[1] != '\0')
+    {
+        return -1;
+    }
+
+    if (value > (size_t)-1 / scale)
+    {
+        return -1;
+    }
+
+    *size = value * scale;
+
+    return 0;
+}
+
 static oformat_t options_parse_output_format(const char *str)
 {
     oformat_t format;
@@ -353,6 +506,12 @@ static int options_validate(const struct options *options)
         }
     }
 
+    /* nothing is written, so the output options do not matter */
+    if (options->estimate)
+    {
+        return OPTIONS_SUCCESS;
+    }
+
     if (options->output.file.format == OFORMAT_8XG ||
         options->output.file.format == OFORMAT_8XG_AUTO_EXTRACT)
     {
@@ -406,9 +565,27 @@ static int options_validate(const struct options *options)
 static void options_set_default(struct options *options)
 {
     options->prgm = 0;
+    options->cache_dir = getenv(CACHE_ENV_DIR);
+    options->estimate = false;
     options->input.nr_files = 0;
+    options->input.max_files = 0;
+    options->input.files = NULL;
     options->input.default_format = IFORMAT_BIN;
     options->input.default_compression = COMPRESS_NONE;
+    options->input.nr_jobs = 1;
+    options->input.compress_chain = false;
+    compress_options_init(&options->input.compress_options);
+    options->input.dict.name = NULL;
+    options->input.dict.owned_name = NULL;
+    options->input.dict.format = IFORMAT_BIN;
+    options->input.dict.compression = COMPRESS_NONE;
+    options->input.dict.size = 0;
+    options->input.dict.data = NULL;
+    options->input.dict.map = NULL;
+    options->input.dict.map_size = 0;
+    options->input.dict.stream = false;
+    options->input.dict.reloc_table.data = NULL;
+    options->input.dict.reloc_table.size = 0;
     options->output.file.append = false;
     options->output.file.uppercase = false;
     options->output.file.compression = COMPRESS_NONE;
@@ -463,12 +640,247 @@ static void options_set_description(struct options *options, const char *descrip
     }
 }
 
+/*
+ * Splits the next word off a response file line, or sets *token to NULL at
+ * the end of the line. Words are separated by spaces or tabs, and a word in
+ * double quotes may contain them.
+ */
+static int options_response_token(char **next, char **token)
+{
+    char *p = *next;
+
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+    {
+        p++;
+    }
+
+    if (*p == '\0')
+    {
+        *next = p;
+        *token = NULL;
+        return 0;
+    }
+
+    if (*p == '"')
+    {
+        char *end = strchr(p + 1, '"');
+
+        if (end == NULL)
+        {
+            return -1;
+        }
+
+        *end = '\0';
+        *token = p + 1;
+        *next = end + 1;
+        return 0;
+    }
+
+    *token = p;
+
+    while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+    {
+        p++;
+    }
+
+    if (*p != '\0')
+    {
+        *p++ = '\0';
+    }
+
+    *next = p;
+
+    return 0;
+}
+
+static int options_add_response_line(struct options *options,
+                                     const char *path,
+                                     unsigned int nr,
+                                     char *line)
+{
+    struct input_file *file;
+    char *token;
+    char *name;
+    size_t size;
+
+    while (*line == ' ' || *line == '\t')
+    {
+        line++;
+    }
+
+    if (*line == '#')
+    {
+        return 0;
+    }
+
+    if (options_response_token(&line, &token) != 0)
+    {
+        LOG_ERROR("%s:%u: Missing closing quote.\n", path, nr);
+        return -1;
+    }
+
+    if (token == NULL)
+    {
+        return 0;
+    }
+
+    size = strlen(token) + 1;
+
+    name = malloc(size);
+    if (name == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        return -1;
+    }
+
+    memcpy(name, token, size);
+
+    if (input_add_file_path(&options->input, name) != 0)
+    {
+        free(name);
+        return -1;
+    }
+
+    file = &options->input.files[options->input.nr_files - 1];
+    file->owned_name = name;
+
+    for (;;)
+    {
+        bool format;
+        char *value;
+
+        if (options_response_token(&line, &token) != 0)
+        {
+            LOG_ERROR("%s:%u: Missing closing quote.\n", path, nr);
+            return -1;
+        }
+
+        if (token == NULL)
+        {
+            break;
+        }
+
+        if (!strcmp(token, "-j") || !strcmp(token, "--iformat"))
+        {
+            format = true;
+        }
+        else if (!strcmp(token, "-p") || !strcmp(token, "--icompress"))
+        {
+            format = false;
+        }
+        else
+        {
+            LOG_ERROR("%s:%u: Unknown input option \'%s\'.\n", path, nr, token);
+            return -1;
+        }
+
+        if (options_response_token(&line, &value) != 0 || value == NULL)
+        {
+            LOG_ERROR("%s:%u: Missing value for \'%s\'.\n", path, nr, token);
+            return -1;
+        }
+
+        if (format)
+        {
+            file->format = options_parse_input_format(value);
+            if (file->format == IFORMAT_INVALID)
+            {
+                LOG_ERROR("%s:%u: Invalid input format \'%s\'.\n", path, nr, value);
+                return -1;
+            }
+        }
+        else
+        {
+            file->compression = options_parse_compression(value);
+            if (file->compression == COMPRESS_INVALID)
+            {
+                LOG_ERROR("%s:%u: Invalid input compression \'%s\'.\n", path, nr, value);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Adds the inputs listed in a response file, one per line, as if each was
+ * given with -i at this point. A line may follow its path with -j/--iformat
+ * or -p/--icompress to override the current modes for that input only.
+ * Blank lines and lines starting with '#' are skipped.
+ */
+static int options_add_response_file(struct options *options, const char *path)
+{
+    FILE *fd;
+    long file_size;
+    char *buffer;
+    char *line;
+    unsigned int nr;
+    int ret = 0;
+
+    fd = fopen(path, "rb");
+    if (fd == NULL)
+    {
+        LOG_ERROR("Cannot open response file \'%s\': %s\n",
+            path,
+            strerror(errno));
+        return -1;
+    }
+
+    file_size = fseek(fd, 0, SEEK_END) == 0 ? ftell(fd) : -1;
+    if (file_size < 0 || fseek(fd, 0, SEEK_SET) != 0)
+    {
+        LOG_ERROR("Cannot read response file \'%s\'.\n", path);
+        fclose(fd);
+        return -1;
+    }
+
+    buffer = malloc((size_t)file_size + 1);
+    if (buffer == NULL)
+    {
+        LOG_ERROR("Out of memory.\n");
+        fclose(fd);
+        return -1;
+    }
+
+    if (fread(buffer, 1, (size_t)file_size, fd) != (size_t)file_size)
+    {
+        LOG_ERROR("Cannot read response file \'%s\'.\n", path);
+        free(buffer);
+        fclose(fd);
+        return -1;
+    }
+
+    fclose(fd);
+
+    buffer[file_size] = '\0';
+
+    for (line = buffer, nr = 1; line != NULL && ret == 0; ++nr)
+    {
+        char *next = strchr(line, '\n');
+
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+
+        ret = options_add_response_line(options, path, nr, line);
+
+        line = next;
+    }
+
+    free(buffer);
+
+    return ret;
+}
+
 static void options_configure(struct options *options)
 {
     size_t i;
     uint32_t j;
 
-    if (options->input.nr_files == 1)
+    /* a lone -i input takes the last --iformat, even one given after it */
+    if (options->input.nr_files == 1 && options->input.files[0].owned_name == NULL)
     {
         options->input.files[0].format = options->input.default_format;
     }
@@ -500,6 +912,8 @@ static void options_configure(struct options *options)
 
 int options_get(int argc, char *argv[], struct options *options)
 {
+    bool compress_blocks = false;
+
     log_set_level(LOG_BUILD_LEVEL);
 
     if (argc < 2 || argv == NULL || options == NULL)
@@ -516,23 +930,36 @@ int options_get(int argc, char *argv[], struct options *options)
         int c;
         static struct option long_options[] =
         {
-            {"input",        required_argument, 0, 'i'},
-            {"output",       required_argument, 0, 'o'},
-            {"iformat",      required_argument, 0, 'j'},
-            {"oformat",      required_argument, 0, 'k'},
-            {"icompress",    required_argument, 0, 'p'},
-            {"compress",     required_argument, 0, 'c'},
-            {"8xp-compress", required_argument, 0, 'e'},
-            {"maxvarsize",   required_argument, 0, 'm'},
-            {"name",         required_argument, 0, 'n'},
-            {"comment",      required_argument, 0, 'b'},
-            {"description",  required_argument, 0, 'd'},
-            {"archive",      no_argument,       0, 'r'},
-            {"uppercase",    no_argument,       0, 'u'},
-            {"append",       no_argument,       0, 'a'},
-            {"help",         no_argument,       0, 'h'},
-            {"version",      no_argument,       0, 'v'},
-            {"log-level",    required_argument, 0, 'l'},
+            {"input",               required_argument, 0, 'i'},
+            {"output",              required_argument, 0, 'o'},
+            {"iformat",             required_argument, 0, 'j'},
+            {"oformat",             required_argument, 0, 'k'},
+            {"icompress",           required_argument, 0, 'p'},
+            {"compress",            required_argument, 0, 'c'},
+            {"8xp-compress",        required_argument, 0, 'e'},
+            {"maxvarsize",          required_argument, 0, 'm'},
+            {"name",                required_argument, 0, 'n'},
+            {"comment",             required_argument, 0, 'b'},
+            {"description",         required_argument, 0, 'd'},
+            {"archive",             no_argument,       0, 'r'},
+            {"uppercase",           no_argument,       0, 'u'},
+            {"append",              no_argument,       0, 'a'},
+            {"help",                no_argument,       0, 'h'},
+            {"version",             no_argument,       0, 'v'},
+            {"log-level",           required_argument, 0, 'l'},
+            {"jobs",                required_argument, 0, OPTION_JOBS},
+            {"cache-dir",           required_argument, 0, OPTION_CACHE_DIR},
+            {"compress-level",      required_argument, 0, OPTION_COMPRESS_LEVEL},
+            {"compress-force",      no_argument,       0, OPTION_COMPRESS_FORCE},
+            {"compress-mem-limit",  required_argument, 0, OPTION_COMPRESS_MEM_LIMIT},
+            {"compress-blocks",     no_argument,       0, OPTION_COMPRESS_BLOCKS},
+            {"compress-block-size", required_argument, 0, OPTION_COMPRESS_BLOCK_SIZE},
+            {"verify",              no_argument,       0, OPTION_VERIFY},
+            {"compress-goal",       required_argument, 0, OPTION_COMPRESS_GOAL},
+            {"compress-dict",       required_argument, 0, OPTION_COMPRESS_DICT},
+            {"compress-chain",      no_argument,       0, OPTION_COMPRESS_CHAIN},
+            {"compress-fast",       no_argument,       0, OPTION_COMPRESS_FAST},
+            {"estimate",            no_argument,       0, OPTION_ESTIMATE},
             {0, 0, 0, 0}
         };
 
@@ -543,7 +970,14 @@ int options_get(int argc, char *argv[], struct options *options)
         switch (c)
         {
             case 'i':
-                if (input_add_file_path(&options->input, optarg))
+                if (optarg[0] == '@')
+                {
+                    if (options_add_response_file(options, optarg + 1))
+                    {
+                        return OPTIONS_FAILED;
+                    }
+                }
+                else if (input_add_file_path(&options->input, optarg))
                 {
                     return OPTIONS_FAILED;
                 }
@@ -614,6 +1048,114 @@ int options_get(int argc, char *argv[], struct options *options)
                     options_parse_compression(optarg);
                 break;
 
+            case OPTION_JOBS:
+            {
+                long jobs;
+
+                if (options_parse_number(optarg, &jobs) != 0 ||
+                    jobs < 1 || jobs > INPUT_MAX_JOBS)
+                {
+                    LOG_ERROR("Invalid number of jobs (must be 1-%u).\n", (unsigned int)INPUT_MAX_JOBS);
+                    return OPTIONS_FAILED;
+                }
+
+                options->input.nr_jobs = jobs;
+                break;
+            }
+
+            case OPTION_CACHE_DIR:
+                options->cache_dir = optarg;
+                break;
+
+            case OPTION_COMPRESS_LEVEL:
+            {
+                long level;
+
+                if (options_parse_number(optarg, &level) != 0 ||
+                    level < COMPRESS_LEVEL_MIN || level > COMPRESS_LEVEL_MAX)
+                {
+                    LOG_ERROR("Invalid compression level (must be %d-%d).\n",
+                        COMPRESS_LEVEL_MIN, COMPRESS_LEVEL_MAX);
+                    return OPTIONS_FAILED;
+                }
+
+                options->input.compress_options.level = (int)level;
+                break;
+            }
+
+            case OPTION_COMPRESS_FORCE:
+                options->input.compress_options.force = true;
+                break;
+
+            case OPTION_COMPRESS_MEM_LIMIT:
+            {
+                size_t limit;
+
+                if (options_parse_size(optarg, &limit) != 0)
+                {
+                    LOG_ERROR("Invalid memory limit \'%s\'.\n", optarg);
+                    return OPTIONS_FAILED;
+                }
+
+                options->input.compress_options.mem_limit = limit;
+                break;
+            }
+
+            case OPTION_COMPRESS_BLOCKS:
+                options->input.compress_options.block_size = COMPRESS_BLOCK_SIZE_DEFAULT;
+                compress_blocks = true;
+                break;
+
+            case OPTION_COMPRESS_BLOCK_SIZE:
+            {
+                size_t block_size;
+
+                if (options_parse_size(optarg, &block_size) != 0 ||
+                    block_size == 0 || block_size > COMPRESS_BLOCK_SIZE_MAX)
+                {
+                    LOG_ERROR("Invalid compression block size \'%s\'.\n", optarg);
+                    return OPTIONS_FAILED;
+                }
+
+                options->input.compress_options.block_size = block_size;
+                compress_blocks = true;
+                break;
+            }
+
+            case OPTION_VERIFY:
+                options->input.compress_options.verify = true;
+                break;
+
+            case OPTION_COMPRESS_GOAL:
+            {
+                compress_goal_t goal = options_parse_goal(optarg);
+
+                if (goal == COMPRESS_GOAL_INVALID)
+                {
+                    LOG_ERROR("Invalid compression goal \'%s\'.\n", optarg);
+                    return OPTIONS_FAILED;
+                }
+
+                options->input.compress_options.goal = goal;
+                break;
+            }
+
+            case OPTION_COMPRESS_DICT:
+                options->input.dict.name = optarg;
+                break;
+
+            case OPTION_COMPRESS_CHAIN:
+                options->input.compress_chain = true;
+                break;
+
+            case OPTION_COMPRESS_FAST:
+                options->input.compress_options.fast = true;
+                break;
+
+            case OPTION_ESTIMATE:
+                options->estimate = true;
+                break;
+
             case 'h':
                 options_show(options->prgm);
                 return OPTIONS_IGNORE;
@@ -624,6 +1166,23 @@ int options_get(int argc, char *argv[], struct options *options)
         }
     }
 
+    /* blocks are independent by design, so there is nothing to prime */
+    if (compress_blocks &&
+        (options->input.dict.name != NULL || options->input.compress_chain))
+    {
+        LOG_ERROR("Block compression cannot be used with --compress-dict or --compress-chain.\n");
+        return OPTIONS_FAILED;
+    }
+
+    /* nothing on calculator reads the block table, so programs could not run */
+    if (compress_blocks &&
+        (options->output.file.format == OFORMAT_8XP ||
+         options->output.file.format == OFORMAT_8XP_COMPRESSED))
+    {
+        LOG_ERROR("Block compression cannot be used for programs.\n");
+        return OPTIONS_FAILED;
+    }
+
     {
         int ret = options_validate(options);
         if (ret != OPTIONS_SUCCESS)
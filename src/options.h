@@ -50,6 +50,8 @@ enum
 struct options
 {
     const char *prgm;
+    const char *cache_dir;
+    bool estimate;
     struct input input;
     struct output output;
 };
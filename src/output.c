@@ -39,86 +39,6 @@
 
 #define VALUES_PER_LINE 32
 
-static int output_c(const char *name, const unsigned char *data, size_t size, FILE *fd)
-{
-    size_t i;
-
-    fprintf(fd, "unsigned char %s[%lu] =\n{", name, (unsigned long)size);
-    for (i = 0; i < size; ++i)
-    {
-        bool last = i + 1 == size;
-
-        if (i % VALUES_PER_LINE == 0)
-        {
-            fputs("\n    ", fd);
-        }
-
-        if (last)
-        {
-            fprintf(fd, "0x%02x", data[i]);
-        }
-        else
-        {
-            fprintf(fd, "0x%02x,", data[i]);
-        }
-    }
-    fputs("\n};\n", fd);
-
-    return 0;
-}
-
-static int output_asm(const char *name, const unsigned char *data, size_t size, FILE *fd)
-{
-    size_t i;
-
-    fprintf(fd, "%s:\n", name);
-    fprintf(fd, "; %lu bytes\n\tdb\t", (unsigned long)size);
-    for (i = 0; i < size; ++i)
-    {
-        bool last = i + 1 == size;
-
-        if (last || ((i + 1) % VALUES_PER_LINE == 0))
-        {
-            fprintf(fd, "$%02x", data[i]);
-            if (!last)
-            {
-                fputs("\n\tdb\t", fd);
-            }
-        }
-        else
-        {
-             fprintf(fd, "$%02x,", data[i]);
-        }
-    }
-    fputc('\n', fd);
-
-    return 0;
-}
-
-static int output_ice(const char *name, const unsigned char *data, size_t size, FILE *fd)
-{
-    size_t i;
-
-    fprintf(fd, "%s | %lu bytes\n\"", name, (unsigned long)size);
-
-    for (i = 0; i < size; ++i)
-    {
-        fprintf(fd, "%02X", data[i]);
-    }
-
-    fprintf(fd, "\"\n");
-
-    return 0;
-}
-
-static int output_bin(const char *name, const unsigned char *data, size_t size, FILE *fd)
-{
-    size_t ret = fwrite(data, 1, size, fd);
-    (void)name;
-
-    return ret == size ? 0 : -1;
-}
-
 int output_reserve_data(struct output_file *file, size_t capacity)
 {
     uint8_t *tmp;
@@ -162,20 +82,30 @@ void output_free(struct output *output)
     output->file.data_capacity = 0;
 }
 
-int output_write_file(const struct output_file *file)
+int output_stream_open(struct output_stream *stream,
+                       const struct output_file *file,
+                       size_t size)
 {
+    const char *name = file->var.name;
     FILE *fd;
-    int ret;
 
-    if (file == NULL)
+    switch (file->format)
     {
-        return -1;
-    }
+        case OFORMAT_C:
+        case OFORMAT_ASM:
+        case OFORMAT_ICE:
+        case OFORMAT_BIN:
+        case OFORMAT_8XV:
+        case OFORMAT_8XP:
+        case OFORMAT_8XG:
+        case OFORMAT_8EK:
+        case OFORMAT_8XG_AUTO_EXTRACT:
+        case OFORMAT_8XP_COMPRESSED:
+            break;
 
-    if (file->size > 0 && file->data == NULL)
-    {
-        LOG_ERROR("No output data buffer.\n");
-        return -1;
+        default:
+            LOG_ERROR("Unknown output format.\n");
+            return -1;
     }
 
     fd = fopen(file->name, file->append ? "ab" : "wb");
@@ -190,34 +120,167 @@ int output_write_file(const struct output_file *file)
     switch (file->format)
     {
         case OFORMAT_C:
-            ret = output_c(file->var.name, file->data, file->size, fd);
+            fprintf(fd, "unsigned char %s[%lu] =\n{", name, (unsigned long)size);
             break;
 
         case OFORMAT_ASM:
-            ret = output_asm(file->var.name, file->data, file->size, fd);
+            fprintf(fd, "%s:\n", name);
+            fprintf(fd, "; %lu bytes\n\tdb\t", (unsigned long)size);
             break;
 
         case OFORMAT_ICE:
-            ret = output_ice(file->var.name, file->data, file->size, fd);
+            fprintf(fd, "%s | %lu bytes\n\"", name, (unsigned long)size);
             break;
 
-        case OFORMAT_BIN:
-        case OFORMAT_8XV:
-        case OFORMAT_8XP:
-        case OFORMAT_8XG:
-        case OFORMAT_8EK:
-        case OFORMAT_8XG_AUTO_EXTRACT:
-        case OFORMAT_8XP_COMPRESSED:
-            ret = output_bin(file->var.name, file->data, file->size, fd);
+        default:
+            break;
+    }
+
+    stream->file = file;
+    stream->fd = fd;
+    stream->size = size;
+    stream->offset = 0;
+
+    return 0;
+}
+
+int output_stream_write(struct output_stream *stream, const uint8_t *data, size_t size)
+{
+    FILE *fd = stream->fd;
+    size_t i;
+
+    if (size > stream->size - stream->offset)
+    {
+        LOG_ERROR("Output larger than expected.\n");
+        return -1;
+    }
+
+    switch (stream->file->format)
+    {
+        case OFORMAT_C:
+            for (i = stream->offset; i < stream->offset + size; ++i)
+            {
+                bool last = i + 1 == stream->size;
+
+                if (i % VALUES_PER_LINE == 0)
+                {
+                    fputs("\n    ", fd);
+                }
+
+                if (last)
+                {
+                    fprintf(fd, "0x%02x", data[i - stream->offset]);
+                }
+                else
+                {
+                    fprintf(fd, "0x%02x,", data[i - stream->offset]);
+                }
+            }
+            break;
+
+        case OFORMAT_ASM:
+            for (i = stream->offset; i < stream->offset + size; ++i)
+            {
+                bool last = i + 1 == stream->size;
+
+                if (last || ((i + 1) % VALUES_PER_LINE == 0))
+                {
+                    fprintf(fd, "$%02x", data[i - stream->offset]);
+                    if (!last)
+                    {
+                        fputs("\n\tdb\t", fd);
+                    }
+                }
+                else
+                {
+                    fprintf(fd, "$%02x,", data[i - stream->offset]);
+                }
+            }
+            break;
+
+        case OFORMAT_ICE:
+            for (i = 0; i < size; ++i)
+            {
+                fprintf(fd, "%02X", data[i]);
+            }
+            break;
+
+        default:
+            if (fwrite(data, 1, size, fd) != size)
+            {
+                return -1;
+            }
+            break;
+    }
+
+    stream->offset += size;
+
+    return 0;
+}
+
+int output_stream_close(struct output_stream *stream)
+{
+    FILE *fd = stream->fd;
+    int ret = 0;
+
+    if (stream->offset != stream->size)
+    {
+        LOG_ERROR("Output smaller than expected.\n");
+        ret = -1;
+    }
+
+    switch (stream->file->format)
+    {
+        case OFORMAT_C:
+            fputs("\n};\n", fd);
+            break;
+
+        case OFORMAT_ASM:
+            fputc('\n', fd);
+            break;
+
+        case OFORMAT_ICE:
+            fprintf(fd, "\"\n");
             break;
 
         default:
-            LOG_ERROR("Unknown output format.\n");
-            ret = -1;
             break;
     }
 
     fclose(fd);
+    stream->fd = NULL;
+
+    return ret;
+}
+
+int output_write_file(const struct output_file *file)
+{
+    struct output_stream stream;
+    int ret;
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    if (file->size > 0 && file->data == NULL)
+    {
+        LOG_ERROR("No output data buffer.\n");
+        return -1;
+    }
+
+    ret = output_stream_open(&stream, file, file->size);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    ret = output_stream_write(&stream, file->data, file->size);
+
+    if (output_stream_close(&stream) != 0)
+    {
+        ret = -1;
+    }
 
     return ret;
 }
@@ -32,6 +32,7 @@
 #define OUTPUT_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -76,12 +77,26 @@ struct output_file
     size_t uncompressed_size;
     compress_mode_t compression;
     compress_mode_t ti8xp_compression;
+    struct compress_verify verify;
     oformat_t format;
     bool append;
     bool uppercase;
     bool compressed;
 };
 
+/*
+ * Writes an output file in pieces. The total size is given up front for
+ * the headers, and output_stream_write() may then be called any number of
+ * times with data adding up to exactly that size.
+ */
+struct output_stream
+{
+    const struct output_file *file;
+    FILE *fd;
+    size_t size;
+    size_t offset;
+};
+
 struct output
 {
     struct output_file file;
@@ -95,6 +110,14 @@ void output_free(struct output *output);
 
 int output_write_file(const struct output_file *file);
 
+int output_stream_open(struct output_stream *stream,
+                       const struct output_file *file,
+                       size_t size);
+
+int output_stream_write(struct output_stream *stream, const uint8_t *data, size_t size);
+
+int output_stream_close(struct output_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
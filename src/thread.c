@@ -0,0 +1,224 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID arg)
+{
+    struct thread *thread = arg;
+
+    thread->func(thread->arg);
+
+    return 0;
+}
+#else
+static void *thread_entry(void *arg)
+{
+    struct thread *thread = arg;
+
+    thread->func(thread->arg);
+
+    return NULL;
+}
+#endif
+
+int thread_start(struct thread *thread, void (*func)(void *arg), void *arg)
+{
+    if (thread == NULL || func == NULL)
+    {
+        return -1;
+    }
+
+    thread->func = func;
+    thread->arg = arg;
+
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    if (thread->handle == NULL)
+    {
+        return -1;
+    }
+#else
+    if (pthread_create(&thread->handle, NULL, thread_entry, thread) != 0)
+    {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+int thread_join(struct thread *thread)
+{
+    if (thread == NULL)
+    {
+        return -1;
+    }
+
+#ifdef _WIN32
+    if (WaitForSingleObject(thread->handle, INFINITE) != WAIT_OBJECT_0)
+    {
+        return -1;
+    }
+
+    CloseHandle(thread->handle);
+#else
+    if (pthread_join(thread->handle, NULL) != 0)
+    {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+int thread_mutex_init(struct thread_mutex *mutex)
+{
+    if (mutex == NULL)
+    {
+        return -1;
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&mutex->handle);
+#else
+    if (pthread_mutex_init(&mutex->handle, NULL) != 0)
+    {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+void thread_mutex_lock(struct thread_mutex *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_lock(&mutex->handle);
+#endif
+}
+
+void thread_mutex_unlock(struct thread_mutex *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_unlock(&mutex->handle);
+#endif
+}
+
+void thread_mutex_destroy(struct thread_mutex *mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_destroy(&mutex->handle);
+#endif
+}
+
+int thread_key_init(struct thread_key *key)
+{
+    if (key == NULL)
+    {
+        return -1;
+    }
+
+#ifdef _WIN32
+    key->handle = TlsAlloc();
+    if (key->handle == TLS_OUT_OF_INDEXES)
+    {
+        return -1;
+    }
+#else
+    if (pthread_key_create(&key->handle, NULL) != 0)
+    {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+void thread_key_set(struct thread_key *key, void *value)
+{
+#ifdef _WIN32
+    TlsSetValue(key->handle, value);
+#else
+    pthread_setspecific(key->handle, value);
+#endif
+}
+
+void *thread_key_get(struct thread_key *key)
+{
+#ifdef _WIN32
+    return TlsGetValue(key->handle);
+#else
+    return pthread_getspecific(key->handle);
+#endif
+}
+
+void thread_key_destroy(struct thread_key *key)
+{
+#ifdef _WIN32
+    TlsFree(key->handle);
+#else
+    pthread_key_delete(key->handle);
+#endif
+}
+
+unsigned int thread_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors > 0 ? (unsigned int)info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (unsigned int)count : 1;
+#else
+    return 1;
+#endif
+}
@@ -0,0 +1,1127 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Reentrant port of the ZX0 optimizer and compressor by Einar Saukas.
+ * The optimal parse and the emitted stream are unchanged; the block
+ * allocator and scratch arrays have moved into a caller-owned context, and
+ * the optimizer only visits offsets that actually match (see zx0_optimize).
+ */
+
+#include "zx0.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define ZX0_POOL_BLOCKS 10000
+#define ZX0_POOL_MEMORY (ZX0_POOL_BLOCKS * sizeof(struct zx0_block))
+
+/* scratch bytes per offset in the window and per input position */
+#define ZX0_OFFSET_MEMORY (2 * sizeof(struct zx0_block *) + 4 * sizeof(int) + sizeof(struct zx0_idle))
+#define ZX0_INPUT_MEMORY (sizeof(struct zx0_block *) + 2 * sizeof(int))
+
+struct zx0_writer
+{
+    uint8_t *output_data;
+    int output_index;
+    int input_index;
+    int bit_index;
+    int bit_mask;
+    int diff;
+    bool backtrack;
+};
+
+void zx0_ctx_init(struct zx0_ctx *ctx)
+{
+    memset(ctx, 0, sizeof *ctx);
+}
+
+void zx0_ctx_free(struct zx0_ctx *ctx)
+{
+    size_t i;
+
+    if (ctx == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < ctx->nr_pools; ++i)
+    {
+        free(ctx->pools[i]);
+    }
+
+    for (i = 0; i < ZX0_IDLE_BUCKETS; ++i)
+    {
+        free(ctx->heaps[i].offsets);
+    }
+
+    free(ctx->pools);
+    free(ctx->last_literal);
+    free(ctx->last_match);
+    free(ctx->match_length);
+    free(ctx->matches);
+    free(ctx->prev_matches);
+    free(ctx->idle);
+    free(ctx->optimal);
+    free(ctx->best_length);
+    free(ctx->idle_head);
+    free(ctx->tokens);
+    match_probe_free(&ctx->probe);
+
+    zx0_ctx_init(ctx);
+}
+
+static int zx0_ctx_account(struct zx0_ctx *ctx, size_t size)
+{
+    if (ctx->memory_limit != 0 && ctx->memory + size > ctx->memory_limit)
+    {
+        ctx->limit_reached = true;
+        return -1;
+    }
+
+    ctx->memory += size;
+
+    return 0;
+}
+
+static int zx0_ctx_reserve(struct zx0_ctx *ctx, size_t nr_offsets, size_t nr_inputs)
+{
+    size_t i;
+
+    ctx->memory = 0;
+    ctx->limit_reached = false;
+    if (zx0_ctx_account(ctx, nr_offsets * ZX0_OFFSET_MEMORY + nr_inputs * ZX0_INPUT_MEMORY) != 0)
+    {
+        return -1;
+    }
+
+    if (nr_offsets > ctx->offset_capacity)
+    {
+        struct zx0_block **last_literal;
+        struct zx0_block **last_match;
+        struct zx0_idle *idle;
+        int *match_length;
+        int *matches;
+        int *prev_matches;
+
+        last_literal = realloc(ctx->last_literal, nr_offsets * sizeof(struct zx0_block *));
+        if (last_literal == NULL)
+        {
+            return -1;
+        }
+        ctx->last_literal = last_literal;
+
+        last_match = realloc(ctx->last_match, nr_offsets * sizeof(struct zx0_block *));
+        if (last_match == NULL)
+        {
+            return -1;
+        }
+        ctx->last_match = last_match;
+
+        match_length = realloc(ctx->match_length, nr_offsets * sizeof(int));
+        if (match_length == NULL)
+        {
+            return -1;
+        }
+        ctx->match_length = match_length;
+
+        matches = realloc(ctx->matches, nr_offsets * sizeof(int));
+        if (matches == NULL)
+        {
+            return -1;
+        }
+        ctx->matches = matches;
+
+        prev_matches = realloc(ctx->prev_matches, nr_offsets * sizeof(int));
+        if (prev_matches == NULL)
+        {
+            return -1;
+        }
+        ctx->prev_matches = prev_matches;
+
+        idle = realloc(ctx->idle, nr_offsets * sizeof(struct zx0_idle));
+        if (idle == NULL)
+        {
+            return -1;
+        }
+        ctx->idle = idle;
+
+        ctx->offset_capacity = nr_offsets;
+    }
+
+    if (nr_inputs > ctx->input_capacity)
+    {
+        struct zx0_block **optimal;
+        int *best_length;
+        int *idle_head;
+
+        optimal = realloc(ctx->optimal, nr_inputs * sizeof(struct zx0_block *));
+        if (optimal == NULL)
+        {
+            return -1;
+        }
+        ctx->optimal = optimal;
+
+        best_length = realloc(ctx->best_length, nr_inputs * sizeof(int));
+        if (best_length == NULL)
+        {
+            return -1;
+        }
+        ctx->best_length = best_length;
+
+        /* one extra slot for the initial block, which ends before the input */
+        idle_head = realloc(ctx->idle_head, (nr_inputs + 1) * sizeof(int));
+        if (idle_head == NULL)
+        {
+            return -1;
+        }
+        ctx->idle_head = idle_head;
+
+        ctx->input_capacity = nr_inputs;
+    }
+
+    memset(ctx->last_literal, 0, nr_offsets * sizeof(struct zx0_block *));
+    memset(ctx->last_match, 0, nr_offsets * sizeof(struct zx0_block *));
+    memset(ctx->match_length, 0, nr_offsets * sizeof(int));
+    memset(ctx->optimal, 0, nr_inputs * sizeof(struct zx0_block *));
+
+    for (i = 0; i < nr_offsets; ++i)
+    {
+        ctx->idle[i].heap_index = -1;
+    }
+
+    for (i = 0; i <= nr_inputs; ++i)
+    {
+        ctx->idle_head[i] = -1;
+    }
+
+    for (i = 0; i < ZX0_IDLE_BUCKETS; ++i)
+    {
+        ctx->heaps[i].size = 0;
+    }
+
+    /* every block from a previous run is dead, so recycle all pools */
+    ctx->nr_pools_used = 0;
+    ctx->pool_left = 0;
+    ctx->ghost_root = NULL;
+
+    return 0;
+}
+
+static struct zx0_block *zx0_allocate(struct zx0_ctx *ctx,
+                                      int bits,
+                                      int index,
+                                      int offset,
+                                      struct zx0_block *chain)
+{
+    struct zx0_block *ptr;
+
+    if (ctx->ghost_root != NULL)
+    {
+        ptr = ctx->ghost_root;
+        ctx->ghost_root = ptr->ghost_chain;
+        if (ptr->chain != NULL && !--ptr->chain->references)
+        {
+            ptr->chain->ghost_chain = ctx->ghost_root;
+            ctx->ghost_root = ptr->chain;
+        }
+    }
+    else
+    {
+        if (ctx->pool_left == 0)
+        {
+            if (zx0_ctx_account(ctx, ZX0_POOL_MEMORY) != 0)
+            {
+                return NULL;
+            }
+
+            if (ctx->nr_pools_used == ctx->nr_pools)
+            {
+                struct zx0_block **pools;
+                struct zx0_block *pool;
+
+                pool = malloc(ZX0_POOL_MEMORY);
+                if (pool == NULL)
+                {
+                    return NULL;
+                }
+
+                pools = realloc(ctx->pools, (ctx->nr_pools + 1) * sizeof(struct zx0_block *));
+                if (pools == NULL)
+                {
+                    free(pool);
+                    return NULL;
+                }
+
+                ctx->pools = pools;
+                ctx->pools[ctx->nr_pools] = pool;
+                ctx->nr_pools++;
+            }
+
+            ctx->nr_pools_used++;
+            ctx->pool_left = ZX0_POOL_BLOCKS;
+        }
+
+        ptr = &ctx->pools[ctx->nr_pools_used - 1][--ctx->pool_left];
+    }
+
+    ptr->bits = bits;
+    ptr->index = index;
+    ptr->offset = offset;
+    if (chain != NULL)
+    {
+        chain->references++;
+    }
+    ptr->chain = chain;
+    ptr->references = 0;
+
+    return ptr;
+}
+
+static void zx0_assign(struct zx0_ctx *ctx, struct zx0_block **ptr, struct zx0_block *chain)
+{
+    chain->references++;
+    if (*ptr != NULL && !--(*ptr)->references)
+    {
+        (*ptr)->ghost_chain = ctx->ghost_root;
+        ctx->ghost_root = *ptr;
+    }
+    *ptr = chain;
+}
+
+static int zx0_offset_ceiling(int index, int offset_limit)
+{
+    return index > offset_limit ? offset_limit :
+           index < ZX0_INITIAL_OFFSET ? ZX0_INITIAL_OFFSET : index;
+}
+
+static int zx0_elias_gamma_bits(int value)
+{
+    int bits = 1;
+
+    while (value >>= 1)
+    {
+        bits += 2;
+    }
+
+    return bits;
+}
+
+static int zx0_log2(int value)
+{
+    int log = 0;
+
+    while (value >>= 1)
+    {
+        log++;
+    }
+
+    return log;
+}
+
+static bool zx0_is_match(const uint8_t *input_data,
+                         int index,
+                         int offset,
+                         int skip,
+                         int offset_limit)
+{
+    return index > skip && index >= offset && offset <= offset_limit &&
+           input_data[index] == input_data[index - offset];
+}
+
+/* idle offsets are ordered by literal cost, ties going to the lower offset */
+static bool zx0_idle_less(const struct zx0_idle *idle, int a, int b)
+{
+    return idle[a].key < idle[b].key ||
+           (idle[a].key == idle[b].key && a < b);
+}
+
+static void zx0_heap_sift_up(struct zx0_idle *idle, struct zx0_heap *heap, size_t i)
+{
+    int offset = heap->offsets[i];
+
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+
+        if (!zx0_idle_less(idle, offset, heap->offsets[parent]))
+        {
+            break;
+        }
+
+        heap->offsets[i] = heap->offsets[parent];
+        idle[heap->offsets[i]].heap_index = (int)i;
+        i = parent;
+    }
+
+    heap->offsets[i] = offset;
+    idle[offset].heap_index = (int)i;
+}
+
+static void zx0_heap_sift_down(struct zx0_idle *idle, struct zx0_heap *heap, size_t i)
+{
+    int offset = heap->offsets[i];
+
+    for (;;)
+    {
+        size_t child = i * 2 + 1;
+
+        if (child >= heap->size)
+        {
+            break;
+        }
+
+        if (child + 1 < heap->size &&
+            zx0_idle_less(idle, heap->offsets[child + 1], heap->offsets[child]))
+        {
+            child++;
+        }
+
+        if (!zx0_idle_less(idle, heap->offsets[child], offset))
+        {
+            break;
+        }
+
+        heap->offsets[i] = heap->offsets[child];
+        idle[heap->offsets[i]].heap_index = (int)i;
+        i = child;
+    }
+
+    heap->offsets[i] = offset;
+    idle[offset].heap_index = (int)i;
+}
+
+static int zx0_heap_insert(struct zx0_ctx *ctx, int offset, int bucket)
+{
+    struct zx0_heap *heap = &ctx->heaps[bucket];
+
+    if (heap->size == heap->capacity)
+    {
+        size_t capacity = heap->capacity ? heap->capacity * 2 : 256;
+        int *offsets;
+
+        offsets = realloc(heap->offsets, capacity * sizeof(int));
+        if (offsets == NULL)
+        {
+            return -1;
+        }
+
+        heap->offsets = offsets;
+        heap->capacity = capacity;
+    }
+
+    ctx->idle[offset].bucket = bucket;
+    heap->offsets[heap->size++] = offset;
+    zx0_heap_sift_up(ctx->idle, heap, heap->size - 1);
+
+    return 0;
+}
+
+static void zx0_heap_remove(struct zx0_ctx *ctx, int offset)
+{
+    struct zx0_idle *idle = ctx->idle;
+    struct zx0_heap *heap = &ctx->heaps[idle[offset].bucket];
+    size_t i = (size_t)idle[offset].heap_index;
+    int last;
+
+    idle[offset].heap_index = -1;
+
+    last = heap->offsets[--heap->size];
+    if (i < heap->size)
+    {
+        heap->offsets[i] = last;
+        idle[last].heap_index = (int)i;
+        zx0_heap_sift_up(idle, heap, i);
+        zx0_heap_sift_down(idle, heap, (size_t)idle[last].heap_index);
+    }
+}
+
+/*
+ * Offset stopped matching at index, so from now on it can only be extended
+ * with literals. A literal run of length n from its last match costs
+ * bits + 1 + elias_gamma(n) + 8 * n, so the offset is keyed on the part that
+ * does not depend on the current position, and bucketed on elias_gamma(n).
+ */
+static int zx0_idle_push(struct zx0_ctx *ctx, int offset, int index)
+{
+    struct zx0_block *match = ctx->last_match[offset];
+    struct zx0_idle *idle = &ctx->idle[offset];
+    int *head = &ctx->idle_head[match->index + 1];
+
+    idle->key = match->bits - 8 * match->index;
+    if (zx0_heap_insert(ctx, offset, zx0_log2(index - match->index)) != 0)
+    {
+        return -1;
+    }
+
+    idle->prev = -1;
+    idle->next = *head;
+    if (*head >= 0)
+    {
+        ctx->idle[*head].prev = offset;
+    }
+    *head = offset;
+
+    return 0;
+}
+
+static void zx0_idle_pop(struct zx0_ctx *ctx, int offset)
+{
+    struct zx0_idle *idle = &ctx->idle[offset];
+
+    zx0_heap_remove(ctx, offset);
+
+    if (idle->prev >= 0)
+    {
+        ctx->idle[idle->prev].next = idle->next;
+    }
+    else
+    {
+        ctx->idle_head[ctx->last_match[offset]->index + 1] = idle->next;
+    }
+
+    if (idle->next >= 0)
+    {
+        ctx->idle[idle->next].prev = idle->prev;
+    }
+}
+
+/*
+ * Produces the same parse as the reference optimizer, which for every
+ * position walks every offset in the window. Offsets that do not match
+ * only extend their last match with literals, so rather than visiting
+ * them they are kept idle in cost order, and per position only the
+ * offsets found on the match index chain of the current byte plus the
+ * cheapest idle offset are considered, in the reference order of
+ * increasing offset.
+ */
+struct zx0_block *zx0_optimize(struct zx0_ctx *ctx,
+                               const struct match_index *match_index,
+                               int skip,
+                               int offset_limit,
+                               void (*progress)(void))
+{
+    struct zx0_block **last_literal;
+    struct zx0_block **last_match;
+    struct zx0_block **optimal;
+    struct zx0_block *block;
+    struct zx0_idle *idle;
+    const uint8_t *input_data;
+    const int32_t *prev_byte;
+    int input_size;
+    int *match_length;
+    int *best_length;
+    int *matches;
+    int *prev_matches;
+    int *swap;
+    int nr_matches;
+    int nr_prev_matches;
+    int best_length_size;
+    int literal_offset;
+    int literal_bits;
+    int position;
+    int bits;
+    int index;
+    int offset;
+    int length;
+    int bits2;
+    int dots = 2;
+    int max_offset;
+    int i;
+
+    if (ctx == NULL || match_index == NULL || match_index->data == NULL ||
+        match_index->size == 0 || match_index->size > INT32_MAX)
+    {
+        return NULL;
+    }
+
+    input_data = match_index->data;
+    input_size = (int)match_index->size;
+    prev_byte = match_index->prev_byte;
+
+    max_offset = zx0_offset_ceiling(input_size - 1, offset_limit);
+
+    if (zx0_ctx_reserve(ctx, (size_t)max_offset + 1,
+            input_size > 2 ? (size_t)input_size : 3) != 0)
+    {
+        return NULL;
+    }
+
+    last_literal = ctx->last_literal;
+    last_match = ctx->last_match;
+    optimal = ctx->optimal;
+    match_length = ctx->match_length;
+    best_length = ctx->best_length;
+    matches = ctx->matches;
+    prev_matches = ctx->prev_matches;
+    idle = ctx->idle;
+
+    best_length[2] = 2;
+
+/* allocation failures abandon the parse; the context stays reusable */
+#define ZX0_ALLOCATE(bits, index, offset, chain) \
+do { \
+    block = zx0_allocate(ctx, bits, index, offset, chain); \
+    if (block == NULL) \
+    { \
+        return NULL; \
+    } \
+} while (0)
+
+    /* start with fake block */
+    ZX0_ALLOCATE(-1, skip - 1, ZX0_INITIAL_OFFSET, NULL);
+    zx0_assign(ctx, &last_match[ZX0_INITIAL_OFFSET], block);
+    if (zx0_idle_push(ctx, ZX0_INITIAL_OFFSET, skip) != 0)
+    {
+        return NULL;
+    }
+
+    nr_prev_matches = 0;
+
+    for (index = skip; index < input_size; index++)
+    {
+        best_length_size = 2;
+        max_offset = zx0_offset_ceiling(index, offset_limit);
+
+        /* idle offsets whose literal run reached a power of two move up a bucket */
+        for (i = 0; i + 1 < ZX0_IDLE_BUCKETS && (2L << i) <= (long)index - skip + 1; i++)
+        {
+            int next;
+
+            for (offset = ctx->idle_head[index - (2 << i) + 1]; offset >= 0; offset = next)
+            {
+                next = idle[offset].next;
+                zx0_heap_remove(ctx, offset);
+                if (zx0_heap_insert(ctx, offset, i + 1) != 0)
+                {
+                    return NULL;
+                }
+            }
+        }
+
+        /* offsets that stopped matching can now only be extended with literals */
+        for (i = 0; i < nr_prev_matches; i++)
+        {
+            offset = prev_matches[i];
+            if (last_match[offset] != NULL &&
+                !zx0_is_match(input_data, index, offset, skip, offset_limit))
+            {
+                if (zx0_idle_push(ctx, offset, index) != 0)
+                {
+                    return NULL;
+                }
+            }
+        }
+
+        /* offsets matching here, nearest first */
+        nr_matches = 0;
+        if (index != skip)
+        {
+            for (position = prev_byte[index];
+                 position != MATCH_NONE && index - position <= max_offset;
+                 position = prev_byte[position])
+            {
+                offset = index - position;
+                matches[nr_matches++] = offset;
+
+                /* a new run of matches settles the literals since the last one */
+                if (!zx0_is_match(input_data, index - 1, offset, skip, offset_limit))
+                {
+                    match_length[offset] = 0;
+                    if (last_match[offset] != NULL)
+                    {
+                        zx0_idle_pop(ctx, offset);
+                        length = index - 1 - last_match[offset]->index;
+                        bits = last_match[offset]->bits + 1 +
+                               zx0_elias_gamma_bits(length) + length * 8;
+                        ZX0_ALLOCATE(bits, index - 1, 0, last_match[offset]);
+                        zx0_assign(ctx, &last_literal[offset], block);
+                    }
+                }
+            }
+        }
+
+        /* cheapest literal extension over all idle offsets */
+        literal_offset = 0;
+        literal_bits = 0;
+        for (i = 0; i < ZX0_IDLE_BUCKETS; i++)
+        {
+            if (ctx->heaps[i].size > 0)
+            {
+                offset = ctx->heaps[i].offsets[0];
+                bits = idle[offset].key + 8 * index + 2 * i + 2;
+                if (literal_offset == 0 || bits < literal_bits ||
+                    (bits == literal_bits && offset < literal_offset))
+                {
+                    literal_offset = offset;
+                    literal_bits = bits;
+                }
+            }
+        }
+
+        for (i = 0; i <= nr_matches; i++)
+        {
+            offset = i < nr_matches ? matches[i] : max_offset + 1;
+
+            /* copy literals */
+            if (literal_offset != 0 && literal_offset < offset)
+            {
+                if (optimal[index] == NULL || optimal[index]->bits > literal_bits)
+                {
+                    ZX0_ALLOCATE(literal_bits, index, 0, last_match[literal_offset]);
+                    zx0_assign(ctx, &optimal[index], block);
+                }
+                literal_offset = 0;
+            }
+
+            if (i == nr_matches)
+            {
+                break;
+            }
+
+            /* copy from last offset */
+            if (last_literal[offset] != NULL)
+            {
+                length = index - last_literal[offset]->index;
+                bits = last_literal[offset]->bits + 1 + zx0_elias_gamma_bits(length);
+                ZX0_ALLOCATE(bits, index, offset, last_literal[offset]);
+                zx0_assign(ctx, &last_match[offset], block);
+                if (optimal[index] == NULL || optimal[index]->bits > bits)
+                {
+                    zx0_assign(ctx, &optimal[index], last_match[offset]);
+                }
+            }
+
+            /* copy from new offset */
+            if (++match_length[offset] > 1)
+            {
+                if (best_length_size < match_length[offset])
+                {
+                    bits = optimal[index - best_length[best_length_size]]->bits +
+                           zx0_elias_gamma_bits(best_length[best_length_size] - 1);
+                    do
+                    {
+                        best_length_size++;
+                        bits2 = optimal[index - best_length_size]->bits +
+                                zx0_elias_gamma_bits(best_length_size - 1);
+                        if (bits2 <= bits)
+                        {
+                            best_length[best_length_size] = best_length_size;
+                            bits = bits2;
+                        }
+                        else
+                        {
+                            best_length[best_length_size] = best_length[best_length_size - 1];
+                        }
+                    } while (best_length_size < match_length[offset]);
+                }
+
+                length = best_length[match_length[offset]];
+                bits = optimal[index - length]->bits + 8 +
+                       zx0_elias_gamma_bits((offset - 1) / 128 + 1) +
+                       zx0_elias_gamma_bits(length - 1);
+                if (last_match[offset] == NULL ||
+                    last_match[offset]->index != index ||
+                    last_match[offset]->bits > bits)
+                {
+                    ZX0_ALLOCATE(bits, index, offset, optimal[index - length]);
+                    zx0_assign(ctx, &last_match[offset], block);
+                    if (optimal[index] == NULL || optimal[index]->bits > bits)
+                    {
+                        zx0_assign(ctx, &optimal[index], last_match[offset]);
+                    }
+                }
+            }
+        }
+
+        /* the current matches become the previous ones */
+        swap = prev_matches;
+        prev_matches = matches;
+        matches = swap;
+        nr_prev_matches = nr_matches;
+
+        if (progress != NULL && (long)index * 50 / input_size > dots)
+        {
+            progress();
+            dots++;
+        }
+    }
+
+#undef ZX0_ALLOCATE
+
+    return optimal[input_size - 1];
+}
+
+static int zx0_match_bits(int offset, int length)
+{
+    return 8 + zx0_elias_gamma_bits((offset - 1) / 128 + 1) + zx0_elias_gamma_bits(length - 1);
+}
+
+/*
+ * Greedy parse with one step of lazy matching for quick builds, looking only
+ * at the candidates kept by the context's match probe. After a run of
+ * literals the last offset is tried first, as reusing it is cheap. The
+ * blocks are costed the same way as zx0_optimize's, so zx0_compress writes
+ * them unchanged. Every token takes at least one byte, so the blocks are
+ * taken in order from a flat array sized to the input instead of the pools.
+ */
+struct zx0_block *zx0_optimize_fast(struct zx0_ctx *ctx,
+                                    const uint8_t *input_data,
+                                    int input_size,
+                                    int skip,
+                                    int offset_limit)
+{
+    struct zx0_block *tokens;
+    struct zx0_block *block;
+    struct zx0_block *literals = NULL;
+    size_t nr_tokens;
+    size_t misses = 0;
+    int literal_bits = 0;
+    int last_offset = ZX0_INITIAL_OFFSET;
+    int index;
+
+    if (ctx == NULL || input_data == NULL || input_size <= 0)
+    {
+        return NULL;
+    }
+
+    if (skip < 0 || skip >= input_size)
+    {
+        return NULL;
+    }
+
+    if (offset_limit < 1 || offset_limit > ZX0_MAX_OFFSET)
+    {
+        offset_limit = ZX0_MAX_OFFSET;
+    }
+
+    /* one block per input byte at most, plus the fake block */
+    nr_tokens = (size_t)(input_size - skip) + 1;
+
+    ctx->memory = 0;
+    ctx->limit_reached = false;
+    if (zx0_ctx_account(ctx, nr_tokens * sizeof(struct zx0_block)) != 0)
+    {
+        return NULL;
+    }
+
+    if (nr_tokens > ctx->token_capacity)
+    {
+        tokens = realloc(ctx->tokens, nr_tokens * sizeof(struct zx0_block));
+        if (tokens == NULL)
+        {
+            return NULL;
+        }
+        ctx->tokens = tokens;
+        ctx->token_capacity = nr_tokens;
+    }
+
+    if (match_probe_reset(&ctx->probe, input_data, (size_t)input_size) != 0)
+    {
+        return NULL;
+    }
+
+    tokens = ctx->tokens;
+
+#define ZX0_TOKEN(b, i, o, c) \
+do { \
+    tokens->chain = (c); \
+    tokens->ghost_chain = NULL; \
+    tokens->bits = (b); \
+    tokens->index = (i); \
+    tokens->offset = (o); \
+    tokens->references = 0; \
+    block = tokens++; \
+} while (0)
+
+    /* start with fake block */
+    ZX0_TOKEN(-1, skip - 1, ZX0_INITIAL_OFFSET, NULL);
+
+    for (index = skip; index < input_size;)
+    {
+        size_t match_offset = 0;
+        size_t next_offset;
+        int offset = 0;
+        int length = 0;
+
+        if (literals != NULL && index >= last_offset)
+        {
+            /* a match on the last offset costs no more than a literal */
+            while (index + length + 8 <= input_size &&
+                   memcmp(input_data + index + length, input_data + index + length - last_offset, 8) == 0)
+            {
+                length += 8;
+            }
+            while (index + length < input_size &&
+                   input_data[index + length] == input_data[index + length - last_offset])
+            {
+                length++;
+            }
+            offset = last_offset;
+        }
+
+        if (index > skip)
+        {
+            int new_length = (int)match_probe_longest(&ctx->probe, (size_t)index, (size_t)offset_limit,
+                                                      (size_t)input_size, &match_offset);
+
+            /* a new offset has to pay for itself against literals */
+            if (new_length > length + 1 &&
+                zx0_match_bits((int)match_offset, new_length) < 8 * new_length + 2 &&
+                (int)match_probe_longest(&ctx->probe, (size_t)index + 1, (size_t)offset_limit,
+                                         (size_t)input_size, &next_offset) <= new_length + 1)
+            {
+                offset = (int)match_offset;
+                length = new_length;
+            }
+        }
+
+        if (length > 0 && offset == last_offset && literals != NULL)
+        {
+            ZX0_TOKEN(block->bits + 1 + zx0_elias_gamma_bits(length),
+                      index + length - 1, offset, block);
+            literals = NULL;
+            misses = 0;
+        }
+        else if (length > 1 && offset != last_offset)
+        {
+            ZX0_TOKEN(block->bits + zx0_match_bits(offset, length),
+                      index + length - 1, offset, block);
+            literals = NULL;
+            last_offset = offset;
+            misses = 0;
+        }
+        else
+        {
+            /* extend the current run of literals, or start one */
+            length = 1 + (int)(misses++ >> MATCH_PROBE_SKIP_SHIFT);
+            if (length > input_size - index)
+            {
+                length = input_size - index;
+            }
+            if (literals == NULL)
+            {
+                literal_bits = block->bits;
+                ZX0_TOKEN(0, index - 1, 0, block);
+                literals = block;
+            }
+            literals->index += length;
+            literals->bits = literal_bits + 1 +
+                zx0_elias_gamma_bits(literals->index - literals->chain->index) +
+                8 * (literals->index - literals->chain->index);
+        }
+
+        index += length;
+    }
+
+#undef ZX0_TOKEN
+
+    return block;
+}
+
+static void zx0_read_bytes(struct zx0_writer *w, int n, int *delta)
+{
+    w->input_index += n;
+    w->diff += n;
+    if (*delta < w->diff)
+    {
+        *delta = w->diff;
+    }
+}
+
+static void zx0_write_byte(struct zx0_writer *w, int value)
+{
+    w->output_data[w->output_index++] = (uint8_t)value;
+    w->diff--;
+}
+
+static void zx0_write_bit(struct zx0_writer *w, int value)
+{
+    if (w->backtrack)
+    {
+        if (value)
+        {
+            w->output_data[w->output_index - 1] |= 1;
+        }
+        w->backtrack = false;
+    }
+    else
+    {
+        if (!w->bit_mask)
+        {
+            w->bit_mask = 128;
+            w->bit_index = w->output_index;
+            zx0_write_byte(w, 0);
+        }
+        if (value)
+        {
+            w->output_data[w->bit_index] |= w->bit_mask;
+        }
+        w->bit_mask >>= 1;
+    }
+}
+
+static void zx0_write_interlaced_elias_gamma(struct zx0_writer *w,
+                                             int value,
+                                             int backwards_mode,
+                                             int invert_mode)
+{
+    int i;
+
+    for (i = 2; i <= value; i <<= 1)
+    {
+        ;
+    }
+
+    i >>= 1;
+    while (i >>= 1)
+    {
+        zx0_write_bit(w, backwards_mode);
+        zx0_write_bit(w, invert_mode ? !(value & i) : (value & i));
+    }
+
+    zx0_write_bit(w, !backwards_mode);
+}
+
+/* the size of the stream zx0_compress writes for a parse, end marker included */
+int zx0_compressed_size(const struct zx0_block *optimal)
+{
+    return (optimal->bits + 25) / 8;
+}
+
+uint8_t *zx0_compress(struct zx0_block *optimal,
+                      const uint8_t *input_data,
+                      int input_size,
+                      int skip,
+                      int backwards_mode,
+                      int invert_mode,
+                      int *output_size,
+                      int *delta)
+{
+    struct zx0_writer w;
+    struct zx0_block *prev;
+    struct zx0_block *next;
+    int last_offset = ZX0_INITIAL_OFFSET;
+    int length;
+    int i;
+
+    if (optimal == NULL || input_data == NULL || output_size == NULL || delta == NULL)
+    {
+        return NULL;
+    }
+
+    /* calculate and allocate output buffer */
+    *output_size = zx0_compressed_size(optimal);
+    w.output_data = calloc(*output_size, 1);
+    if (w.output_data == NULL)
+    {
+        return NULL;
+    }
+
+    /* un-reverse optimal sequence */
+    prev = NULL;
+    while (optimal != NULL)
+    {
+        next = optimal->chain;
+        optimal->chain = prev;
+        prev = optimal;
+        optimal = next;
+    }
+
+    w.diff = *output_size - input_size + skip;
+    w.input_index = skip;
+    w.output_index = 0;
+    w.bit_index = 0;
+    w.bit_mask = 0;
+    w.backtrack = true;
+    *delta = 0;
+
+    for (optimal = prev->chain; optimal != NULL; prev = optimal, optimal = optimal->chain)
+    {
+        length = optimal->index - prev->index;
+
+        if (!optimal->offset)
+        {
+            /* copy literals indicator */
+            zx0_write_bit(&w, 0);
+
+            /* copy literals length */
+            zx0_write_interlaced_elias_gamma(&w, length, backwards_mode, false);
+
+            /* copy literals values */
+            for (i = 0; i < length; i++)
+            {
+                zx0_write_byte(&w, input_data[w.input_index]);
+                zx0_read_bytes(&w, 1, delta);
+            }
+        }
+        else if (optimal->offset == last_offset)
+        {
+            /* copy from last offset indicator */
+            zx0_write_bit(&w, 0);
+
+            /* copy from last offset length */
+            zx0_write_interlaced_elias_gamma(&w, length, backwards_mode, false);
+            zx0_read_bytes(&w, length, delta);
+        }
+        else
+        {
+            /* copy from new offset indicator */
+            zx0_write_bit(&w, 1);
+
+            /* copy from new offset MSB */
+            zx0_write_interlaced_elias_gamma(&w, (optimal->offset - 1) / 128 + 1,
+                backwards_mode, invert_mode);
+
+            /* copy from new offset LSB */
+            if (backwards_mode)
+            {
+                zx0_write_byte(&w, ((optimal->offset - 1) % 128) << 1);
+            }
+            else
+            {
+                zx0_write_byte(&w, (127 - (optimal->offset - 1) % 128) << 1);
+            }
+
+            /* copy from new offset length */
+            w.backtrack = true;
+            zx0_write_interlaced_elias_gamma(&w, length - 1, backwards_mode, false);
+            zx0_read_bytes(&w, length, delta);
+
+            last_offset = optimal->offset;
+        }
+    }
+
+    /* end marker */
+    zx0_write_bit(&w, 1);
+    zx0_write_interlaced_elias_gamma(&w, 256, backwards_mode, invert_mode);
+
+    return w.output_data;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ZX0_H
+#define ZX0_H
+
+#include "match.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZX0_INITIAL_OFFSET 1
+#define ZX0_MAX_OFFSET 32640
+#define ZX0_QUICK_MAX_OFFSET 2176
+
+struct zx0_block
+{
+    struct zx0_block *chain;
+    struct zx0_block *ghost_chain;
+    int bits;
+    int index;
+    int offset;
+    int references;
+};
+
+#define ZX0_IDLE_BUCKETS 32
+
+/*
+ * Bookkeeping for an offset that has a last match but does not match at the
+ * current position, so its only use is to be extended with literals. Idle
+ * offsets are kept in heaps bucketed by the Elias gamma length of their
+ * literal run, and in per-position lists so they can change bucket.
+ */
+struct zx0_idle
+{
+    int key;
+    int bucket;
+    int heap_index;
+    int prev;
+    int next;
+};
+
+struct zx0_heap
+{
+    int *offsets;
+    size_t size;
+    size_t capacity;
+};
+
+/*
+ * Holds everything the zx0 optimizer would otherwise keep in global state:
+ * the block pool, the idle offset heaps, the per-offset and per-position
+ * scratch arrays and the flat token array of the fast parser.
+ * A context may be reused for any number of compressions, but must only be
+ * used by one thread at a time.
+ *
+ * memory is roughly what the last run needed at its peak, counting only the
+ * blocks and arrays that run used so it does not depend on earlier runs. If
+ * memory_limit is nonzero, a run that would need more fails with
+ * limit_reached set.
+ */
+struct zx0_ctx
+{
+    struct zx0_block **pools;
+    size_t nr_pools;
+    size_t nr_pools_used;
+    size_t pool_left;
+    struct zx0_block *ghost_root;
+    struct zx0_block **last_literal;
+    struct zx0_block **last_match;
+    int *match_length;
+    int *matches;
+    int *prev_matches;
+    struct zx0_idle *idle;
+    size_t offset_capacity;
+    struct zx0_block **optimal;
+    int *best_length;
+    int *idle_head;
+    size_t input_capacity;
+    struct zx0_heap heaps[ZX0_IDLE_BUCKETS];
+    struct zx0_block *tokens;
+    size_t token_capacity;
+    struct match_probe probe;
+    size_t memory_limit;
+    size_t memory;
+    bool limit_reached;
+};
+
+void zx0_ctx_init(struct zx0_ctx *ctx);
+
+void zx0_ctx_free(struct zx0_ctx *ctx);
+
+struct zx0_block *zx0_optimize(struct zx0_ctx *ctx,
+                               const struct match_index *match_index,
+                               int skip,
+                               int offset_limit,
+                               void (*progress)(void));
+
+struct zx0_block *zx0_optimize_fast(struct zx0_ctx *ctx,
+                                    const uint8_t *input_data,
+                                    int input_size,
+                                    int skip,
+                                    int offset_limit);
+
+int zx0_compressed_size(const struct zx0_block *optimal);
+
+uint8_t *zx0_compress(struct zx0_block *optimal,
+                      const uint8_t *input_data,
+                      int input_size,
+                      int skip,
+                      int backwards_mode,
+                      int invert_mode,
+                      int *output_size,
+                      int *delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
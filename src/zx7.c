@@ -0,0 +1,626 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Reentrant port of the ZX7 optimizer and compressor by Einar Saukas.
+ * The optimal parse and the emitted stream are unchanged; the bit writer
+ * state lives on the stack so any number of threads may compress at once,
+ * and candidate matches come from a prebuilt, read-only match index.
+ */
+
+#include "zx7.h"
+
+#include <string.h>
+
+struct zx7_writer
+{
+    uint8_t *output_data;
+    size_t output_index;
+    size_t bit_index;
+    int bit_mask;
+    long diff;
+};
+
+static int zx7_elias_gamma_bits(size_t value)
+{
+    int bits = 1;
+
+    while (value > 1)
+    {
+        bits += 2;
+        value >>= 1;
+    }
+
+    return bits;
+}
+
+static int zx7_count_bits(int offset, size_t len)
+{
+    return 1 + (offset > 128 ? 12 : 8) + zx7_elias_gamma_bits(len - 1);
+}
+
+void zx7_ctx_init(struct zx7_ctx *ctx)
+{
+    ctx->last_pair = NULL;
+    ctx->prev_pair = NULL;
+    ctx->min = NULL;
+    ctx->max = NULL;
+    match_probe_init(&ctx->probe);
+}
+
+void zx7_ctx_free(struct zx7_ctx *ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+
+    free(ctx->last_pair);
+    free(ctx->prev_pair);
+    free(ctx->min);
+    free(ctx->max);
+    match_probe_free(&ctx->probe);
+
+    zx7_ctx_init(ctx);
+}
+
+static int zx7_ctx_alloc(struct zx7_ctx *ctx)
+{
+    if (ctx->last_pair == NULL)
+    {
+        ctx->last_pair = malloc(256 * 256 * sizeof(int32_t));
+        ctx->prev_pair = malloc(ZX7_WINDOW_SIZE * sizeof(int32_t));
+        ctx->min = malloc((ZX7_MAX_OFFSET + 1) * sizeof(size_t));
+        ctx->max = malloc((ZX7_MAX_OFFSET + 1) * sizeof(size_t));
+        if (ctx->last_pair == NULL || ctx->prev_pair == NULL ||
+            ctx->min == NULL || ctx->max == NULL)
+        {
+            zx7_ctx_free(ctx);
+            return -1;
+        }
+    }
+
+    memset(ctx->min, 0, (ZX7_MAX_OFFSET + 1) * sizeof(size_t));
+    memset(ctx->max, 0, (ZX7_MAX_OFFSET + 1) * sizeof(size_t));
+
+    return 0;
+}
+
+/*
+ * Links position i to the previous position ending the same two bytes, the
+ * same chain match_index_build makes, but only kept for the window.
+ */
+static void zx7_ctx_add(struct zx7_ctx *ctx, const uint8_t *input_data, size_t i)
+{
+    unsigned int pair = (unsigned int)input_data[i - 1] << 8 | input_data[i];
+
+    ctx->prev_pair[i % ZX7_WINDOW_SIZE] = ctx->last_pair[pair];
+    ctx->last_pair[pair] = (int32_t)i;
+}
+
+struct zx7_optimal *zx7_optimize(struct zx7_ctx *ctx,
+                                 const uint8_t *input_data,
+                                 size_t input_size,
+                                 size_t skip,
+                                 int offset_limit,
+                                 size_t length_limit)
+{
+    return zx7_optimize_resume(ctx, input_data, input_size, skip,
+                               offset_limit, length_limit, NULL, 0, NULL);
+}
+
+void zx7_checkpoint_init(struct zx7_checkpoint *checkpoint)
+{
+    checkpoint->offset_limit = 0;
+    checkpoint->nr_snapshots = 0;
+    checkpoint->min = NULL;
+    checkpoint->max = NULL;
+}
+
+void zx7_checkpoint_free(struct zx7_checkpoint *checkpoint)
+{
+    if (checkpoint == NULL)
+    {
+        return;
+    }
+
+    free(checkpoint->min);
+    free(checkpoint->max);
+    zx7_checkpoint_init(checkpoint);
+}
+
+/*
+ * The parse of position i only reads the data up to i, so after a change at
+ * some position everything before it can be taken from an earlier parse. The
+ * per-offset min/max bounds are the only other state carried between
+ * positions, and they are restored from the last snapshot before the change.
+ * Matches never reach back further than offset_limit, so a candidate chain
+ * stops as soon as it leaves the window, and only positions still in the
+ * window are ever looked up in the ring. When resuming, the ring is rebuilt
+ * from the window before the resume position.
+ */
+struct zx7_optimal *zx7_optimize_resume(struct zx7_ctx *ctx,
+                                        const uint8_t *input_data,
+                                        size_t input_size,
+                                        size_t skip,
+                                        int offset_limit,
+                                        size_t length_limit,
+                                        const struct zx7_optimal *previous,
+                                        size_t resume,
+                                        struct zx7_checkpoint *checkpoint)
+{
+    struct zx7_optimal *optimal;
+    size_t nr_snapshots = 0;
+    size_t stride;
+    size_t *min;
+    size_t *max;
+    int32_t match;
+    int offset;
+    size_t len;
+    size_t best_len;
+    size_t bits;
+    size_t i;
+
+    if (ctx == NULL || input_data == NULL)
+    {
+        return NULL;
+    }
+
+    if (input_size == 0 || skip >= input_size || input_size > ZX7_MAX_INPUT_SIZE)
+    {
+        return NULL;
+    }
+
+    if (offset_limit < 1 || offset_limit > ZX7_MAX_OFFSET)
+    {
+        offset_limit = ZX7_MAX_OFFSET;
+    }
+
+    if (length_limit < 2 || length_limit > ZX7_MAX_LEN)
+    {
+        length_limit = ZX7_MAX_LEN;
+    }
+
+    stride = (size_t)offset_limit + 1;
+
+    if (previous == NULL || checkpoint == NULL ||
+        checkpoint->offset_limit != offset_limit ||
+        resume <= skip || resume >= input_size ||
+        resume % ZX7_CHECKPOINT_INTERVAL != 0 ||
+        resume / ZX7_CHECKPOINT_INTERVAL >= checkpoint->nr_snapshots)
+    {
+        resume = 0;
+    }
+
+    if (zx7_ctx_alloc(ctx) != 0)
+    {
+        return NULL;
+    }
+
+    min = ctx->min;
+    max = ctx->max;
+
+    optimal = calloc(input_size, sizeof(struct zx7_optimal));
+    if (optimal == NULL)
+    {
+        goto fail;
+    }
+
+    if (checkpoint != NULL)
+    {
+        uint32_t *snapshot_min;
+        uint32_t *snapshot_max;
+
+        nr_snapshots = (input_size - 1) / ZX7_CHECKPOINT_INTERVAL + 1;
+
+        if (resume == 0)
+        {
+            zx7_checkpoint_free(checkpoint);
+        }
+        else
+        {
+            const uint32_t *restore_min = checkpoint->min + resume / ZX7_CHECKPOINT_INTERVAL * stride;
+            const uint32_t *restore_max = checkpoint->max + resume / ZX7_CHECKPOINT_INTERVAL * stride;
+
+            for (offset = 1; offset <= offset_limit; ++offset)
+            {
+                min[offset] = restore_min[offset];
+                max[offset] = restore_max[offset];
+            }
+        }
+
+        snapshot_min = realloc(checkpoint->min, nr_snapshots * stride * sizeof(uint32_t));
+        if (snapshot_min == NULL)
+        {
+            goto fail;
+        }
+        checkpoint->min = snapshot_min;
+
+        snapshot_max = realloc(checkpoint->max, nr_snapshots * stride * sizeof(uint32_t));
+        if (snapshot_max == NULL)
+        {
+            goto fail;
+        }
+        checkpoint->max = snapshot_max;
+
+        /* snapshots at or before skip are taken before anything is parsed */
+        if (resume == 0)
+        {
+            memset(checkpoint->min, 0, nr_snapshots * stride * sizeof(uint32_t));
+            memset(checkpoint->max, 0, nr_snapshots * stride * sizeof(uint32_t));
+        }
+
+        checkpoint->offset_limit = offset_limit;
+        checkpoint->nr_snapshots = nr_snapshots;
+    }
+
+    if (resume != 0)
+    {
+        memcpy(optimal, previous, resume * sizeof(struct zx7_optimal));
+        i = resume > (size_t)offset_limit + 1 ? resume - offset_limit : 1;
+    }
+    else
+    {
+        /* first byte is always literal */
+        optimal[skip].bits = 8;
+        resume = skip + 1;
+        i = 1;
+    }
+
+    for (match = 0; match < 256 * 256; ++match)
+    {
+        ctx->last_pair[match] = MATCH_NONE;
+    }
+
+    /* positions before resume only need to be in the ring */
+    for (; i < resume; ++i)
+    {
+        zx7_ctx_add(ctx, input_data, i);
+    }
+
+    /* process remaining bytes */
+    for (i = resume; i < input_size; i++)
+    {
+        if (nr_snapshots != 0 && i % ZX7_CHECKPOINT_INTERVAL == 0)
+        {
+            uint32_t *snapshot_min = checkpoint->min + i / ZX7_CHECKPOINT_INTERVAL * stride;
+            uint32_t *snapshot_max = checkpoint->max + i / ZX7_CHECKPOINT_INTERVAL * stride;
+
+            for (offset = 0; offset <= offset_limit; ++offset)
+            {
+                snapshot_min[offset] = (uint32_t)min[offset];
+                snapshot_max[offset] = (uint32_t)max[offset];
+            }
+        }
+
+        zx7_ctx_add(ctx, input_data, i);
+
+        optimal[i].bits = optimal[i - 1].bits + 9;
+        best_len = 1;
+        for (match = ctx->prev_pair[i % ZX7_WINDOW_SIZE];
+             match != MATCH_NONE && best_len < length_limit;
+             match = ctx->prev_pair[(uint32_t)match % ZX7_WINDOW_SIZE])
+        {
+            offset = i - match;
+            if (offset > offset_limit)
+            {
+                break;
+            }
+
+            for (len = 2; len <= length_limit && i >= skip + len; len++)
+            {
+                if (len > best_len)
+                {
+                    best_len = len;
+                    bits = optimal[i - len].bits + zx7_count_bits(offset, len);
+                    if (optimal[i].bits > bits)
+                    {
+                        optimal[i].bits = bits;
+                        optimal[i].offset = offset;
+                        optimal[i].len = len;
+                    }
+                }
+                else if (max[offset] != 0 && i + 1 == max[offset] + len)
+                {
+                    len = i - min[offset];
+                    if (len > best_len)
+                    {
+                        len = best_len;
+                    }
+                }
+
+                if (i < offset + len || input_data[i - len] != input_data[i - len - offset])
+                {
+                    break;
+                }
+            }
+
+            min[offset] = i + 1 - len;
+            max[offset] = i;
+        }
+    }
+
+    return optimal;
+
+fail:
+    if (checkpoint != NULL)
+    {
+        zx7_checkpoint_free(checkpoint);
+    }
+    free(optimal);
+
+    return NULL;
+}
+
+/*
+ * Greedy parse with one step of lazy matching, looking only at the candidates
+ * kept by the context's match probe: a match is taken unless the next
+ * position has one at least two bytes longer. The result has the same
+ * layout as zx7_optimize's, so zx7_compress writes it unchanged.
+ */
+struct zx7_optimal *zx7_optimize_fast(struct zx7_ctx *ctx,
+                                      const uint8_t *input_data,
+                                      size_t input_size,
+                                      size_t skip,
+                                      int offset_limit,
+                                      size_t length_limit)
+{
+    struct zx7_optimal *optimal;
+    size_t misses = 0;
+    size_t bits;
+    size_t i;
+
+    if (ctx == NULL || input_data == NULL)
+    {
+        return NULL;
+    }
+
+    if (input_size == 0 || skip >= input_size || input_size > ZX7_MAX_INPUT_SIZE)
+    {
+        return NULL;
+    }
+
+    if (offset_limit < 1 || offset_limit > ZX7_MAX_OFFSET)
+    {
+        offset_limit = ZX7_MAX_OFFSET;
+    }
+
+    if (length_limit < 2 || length_limit > ZX7_MAX_LEN)
+    {
+        length_limit = ZX7_MAX_LEN;
+    }
+
+    if (match_probe_reset(&ctx->probe, input_data, input_size) != 0)
+    {
+        return NULL;
+    }
+
+    optimal = calloc(input_size, sizeof(struct zx7_optimal));
+    if (optimal == NULL)
+    {
+        return NULL;
+    }
+
+    /* first byte is always literal */
+    bits = 8;
+    optimal[skip].bits = bits;
+
+    for (i = skip + 1; i < input_size;)
+    {
+        size_t offset = 0;
+        size_t next_offset;
+        size_t len;
+
+        len = match_probe_longest(&ctx->probe, i, (size_t)offset_limit,
+                                  length_limit, &offset);
+        if (len >= 2 && len < length_limit &&
+            match_probe_longest(&ctx->probe, i + 1, (size_t)offset_limit,
+                                length_limit, &next_offset) > len + 1)
+        {
+            len = 0;
+            misses = 0;
+        }
+
+        if (len >= 2)
+        {
+            bits += zx7_count_bits((int)offset, len);
+            i += len;
+            optimal[i - 1].bits = bits;
+            optimal[i - 1].offset = (int)offset;
+            optimal[i - 1].len = (int)len;
+            misses = 0;
+        }
+        else
+        {
+            size_t step = 1 + (misses++ >> MATCH_PROBE_SKIP_SHIFT);
+
+            for (; step > 0 && i < input_size; --step)
+            {
+                bits += 9;
+                optimal[i].bits = bits;
+                i++;
+            }
+        }
+    }
+
+    return optimal;
+}
+
+static void zx7_read_bytes(struct zx7_writer *w, int n, long *delta)
+{
+    w->diff += n;
+    if (w->diff > *delta)
+    {
+        *delta = w->diff;
+    }
+}
+
+static void zx7_write_byte(struct zx7_writer *w, int value)
+{
+    w->output_data[w->output_index++] = (uint8_t)value;
+    w->diff--;
+}
+
+static void zx7_write_bit(struct zx7_writer *w, int value)
+{
+    if (w->bit_mask == 0)
+    {
+        w->bit_mask = 128;
+        w->bit_index = w->output_index;
+        zx7_write_byte(w, 0);
+    }
+
+    if (value > 0)
+    {
+        w->output_data[w->bit_index] |= w->bit_mask;
+    }
+
+    w->bit_mask >>= 1;
+}
+
+static void zx7_write_elias_gamma(struct zx7_writer *w, int value)
+{
+    int i;
+
+    for (i = 2; i <= value; i <<= 1)
+    {
+        zx7_write_bit(w, 0);
+    }
+
+    while ((i >>= 1) > 0)
+    {
+        zx7_write_bit(w, value & i);
+    }
+}
+
+/* the size of the stream zx7_compress writes for a parse, end marker included */
+size_t zx7_compressed_size(const struct zx7_optimal *optimal, size_t input_size)
+{
+    return (optimal[input_size - 1].bits + 18 + 7) / 8;
+}
+
+uint8_t *zx7_compress(struct zx7_optimal *optimal,
+                      const uint8_t *input_data,
+                      size_t input_size,
+                      size_t skip,
+                      size_t *output_size,
+                      long *delta)
+{
+    struct zx7_writer w;
+    size_t input_index;
+    size_t input_prev;
+    int offset1;
+    int mask;
+    int i;
+
+    if (optimal == NULL || input_data == NULL || output_size == NULL || delta == NULL)
+    {
+        return NULL;
+    }
+
+    /* calculate and allocate output buffer */
+    input_index = input_size - 1;
+    *output_size = zx7_compressed_size(optimal, input_size);
+    w.output_data = calloc(*output_size, 1);
+    if (w.output_data == NULL)
+    {
+        return NULL;
+    }
+
+    /* initialize delta */
+    w.diff = *output_size - input_size + skip;
+    *delta = 0;
+
+    /* un-reverse optimal sequence */
+    optimal[input_index].bits = 0;
+    while (input_index != skip)
+    {
+        input_prev = input_index - (optimal[input_index].len > 0 ? optimal[input_index].len : 1);
+        optimal[input_prev].bits = input_index;
+        input_index = input_prev;
+    }
+
+    w.output_index = 0;
+    w.bit_index = 0;
+    w.bit_mask = 0;
+
+    /* first byte is always literal */
+    zx7_write_byte(&w, input_data[input_index]);
+    zx7_read_bytes(&w, 1, delta);
+
+    /* process remaining bytes */
+    while ((input_index = optimal[input_index].bits) > 0)
+    {
+        if (optimal[input_index].len == 0)
+        {
+            /* literal indicator */
+            zx7_write_bit(&w, 0);
+
+            /* literal value */
+            zx7_write_byte(&w, input_data[input_index]);
+            zx7_read_bytes(&w, 1, delta);
+        }
+        else
+        {
+            /* sequence indicator */
+            zx7_write_bit(&w, 1);
+
+            /* sequence length */
+            zx7_write_elias_gamma(&w, optimal[input_index].len - 1);
+
+            /* sequence offset */
+            offset1 = optimal[input_index].offset - 1;
+            if (offset1 < 128)
+            {
+                zx7_write_byte(&w, offset1);
+            }
+            else
+            {
+                offset1 -= 128;
+                zx7_write_byte(&w, (offset1 & 127) | 128);
+                for (mask = 1024; mask > 127; mask >>= 1)
+                {
+                    zx7_write_bit(&w, offset1 & mask);
+                }
+            }
+            zx7_read_bytes(&w, optimal[input_index].len, delta);
+        }
+    }
+
+    /* end marker */
+    zx7_write_bit(&w, 1);
+    for (i = 0; i < 16; i++)
+    {
+        zx7_write_bit(&w, 0);
+    }
+    zx7_write_bit(&w, 1);
+
+    return w.output_data;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2017-2026 Matt "MateoConLechuga" Waltz
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ZX7_H
+#define ZX7_H
+
+#include "match.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZX7_MAX_OFFSET 2176
+#define ZX7_MAX_LEN 65536
+#define ZX7_CHECKPOINT_INTERVAL 8192
+#define ZX7_WINDOW_SIZE 4096
+#define ZX7_MAX_INPUT_SIZE 0x10000000
+
+/*
+ * Parse of one position: the bits needed to encode the data up to it, and
+ * the match that ends there, with a length of 0 for a literal. One is kept
+ * for every input byte, so the fields are packed into 8 bytes; bits also
+ * has to hold a position when zx7_compress walks the parse.
+ */
+struct zx7_optimal
+{
+    uint32_t bits;
+    unsigned int offset : 12;
+    unsigned int len : 17;
+};
+
+/*
+ * Scratch memory for zx7_optimize, which may be reused for any number of
+ * parses by one thread at a time. Its size depends only on the window:
+ * candidates are chained through a ring of the last ZX7_WINDOW_SIZE
+ * positions instead of a table covering the whole input.
+ */
+struct zx7_ctx
+{
+    int32_t *last_pair;
+    int32_t *prev_pair;
+    size_t *min;
+    size_t *max;
+    struct match_probe probe;
+};
+
+/*
+ * Optimizer state saved by zx7_optimize_resume so that a later parse of data
+ * sharing a prefix can continue from where the data first differs. Snapshot
+ * n holds the per-offset match bounds for offsets 0 to offset_limit before
+ * position n * ZX7_CHECKPOINT_INTERVAL is parsed.
+ */
+struct zx7_checkpoint
+{
+    int offset_limit;
+    size_t nr_snapshots;
+    uint32_t *min;
+    uint32_t *max;
+};
+
+void zx7_ctx_init(struct zx7_ctx *ctx);
+
+void zx7_ctx_free(struct zx7_ctx *ctx);
+
+struct zx7_optimal *zx7_optimize(struct zx7_ctx *ctx,
+                                 const uint8_t *input_data,
+                                 size_t input_size,
+                                 size_t skip,
+                                 int offset_limit,
+                                 size_t length_limit);
+
+void zx7_checkpoint_init(struct zx7_checkpoint *checkpoint);
+
+void zx7_checkpoint_free(struct zx7_checkpoint *checkpoint);
+
+/*
+ * Same parse as zx7_optimize, taking positions before resume from previous,
+ * the parse of data that is identical up to resume. resume must be a multiple
+ * of ZX7_CHECKPOINT_INTERVAL that checkpoint has a snapshot for, otherwise
+ * the whole data is parsed. The checkpoint is updated for the new data.
+ */
+struct zx7_optimal *zx7_optimize_resume(struct zx7_ctx *ctx,
+                                        const uint8_t *input_data,
+                                        size_t input_size,
+                                        size_t skip,
+                                        int offset_limit,
+                                        size_t length_limit,
+                                        const struct zx7_optimal *previous,
+                                        size_t resume,
+                                        struct zx7_checkpoint *checkpoint);
+
+struct zx7_optimal *zx7_optimize_fast(struct zx7_ctx *ctx,
+                                      const uint8_t *input_data,
+                                      size_t input_size,
+                                      size_t skip,
+                                      int offset_limit,
+                                      size_t length_limit);
+
+size_t zx7_compressed_size(const struct zx7_optimal *optimal, size_t input_size);
+
+uint8_t *zx7_compress(struct zx7_optimal *optimal,
+                      const uint8_t *input_data,
+                      size_t input_size,
+                      size_t skip,
+                      size_t *output_size,
+                      long *delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
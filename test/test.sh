@@ -104,6 +104,9 @@ run_test "8xp_compressed_default" "../bin/convbin --iformat 8x --input inputs/de
 # Test: Convert 8x program to compressed 8xp using zx0 compressor.
 run_test "8xp_compressed_zx0" "../bin/convbin --iformat 8x --input inputs/demo.8xp -e zx0 --oformat 8xp-compressed --output test.8xp --name TEST"
 
+# Test: An empty input to compressed 8xp is rejected with an error (exit code 255), not a crash.
+run_test_expect_fail "8xp_compressed_empty" ": > test.empty.bin && ../bin/convbin --iformat bin --input test.empty.bin --oformat 8xp-compressed --output test.empty.8xp --name TEST; test \$? -ne 255"
+
 # Test: Apply zx7 compression when generating C source.
 run_test "compress_zx7_c" "../bin/convbin --iformat bin --input inputs/small.bin --oformat c --output test.c.test --name TEST --compress zx7"
 
@@ -296,6 +299,144 @@ run_test "csv_empty_to_bin" "../bin/convbin --iformat csv --input test.empty.csv
 # Test: Empty CSV binary output should be zero bytes.
 run_test "csv_empty_to_bin_size_assert" "[ \"\$(wc -c < test.empty.bin)\" = '0' ]"
 
+# Test: Compress several inputs serially as a reference for parallel jobs.
+run_test "jobs_serial_reference" "../bin/convbin --icompress auto --input inputs/small.bin --input inputs/demo.8xp --icompress zx7 --input inputs/libload.8xv --icompress zx0 --input inputs/fileioc.8xv --oformat bin --output test.jobs1.bin"
+
+# Test: Compress the same inputs using multiple jobs.
+run_test "jobs_parallel" "../bin/convbin --jobs 4 --icompress auto --input inputs/small.bin --input inputs/demo.8xp --icompress zx7 --input inputs/libload.8xv --icompress zx0 --input inputs/fileioc.8xv --oformat bin --output test.jobs4.bin"
+
+# Test: Parallel compression output must match the serial output.
+run_test "jobs_parallel_assert" "cmp -s test.jobs1.bin test.jobs4.bin"
+
+# Test: Number of jobs must be at least one.
+run_test_expect_fail "jobs_invalid" "../bin/convbin --jobs 0 --input inputs/small.bin --oformat bin --output test.jobs0.bin"
+
+# Test: Number of jobs must be a whole number.
+run_test_expect_fail "jobs_trailing" "../bin/convbin --jobs 4x --input inputs/small.bin --oformat bin --output test.jobs4x.bin"
+
+# Test: Start from an empty compression cache directory.
+run_test "cache_prepare" "rm -rf test.cache test.cache1.bin test.cache2.bin"
+
+# Test: Compress inputs while populating the compression cache.
+run_test "cache_miss" "set -o pipefail; ../bin/convbin --cache-dir test.cache --icompress auto --input inputs/small.bin --icompress zx0 --input inputs/libload.8xv --oformat bin --compress zx7 --output test.cache1.bin | grep '0 hit(s), 3 miss(es)' > /dev/null && test -s test.cache1.bin"
+
+# Test: The same conversion should be served entirely from the cache.
+run_test "cache_hit" "set -o pipefail; CONVBIN_CACHE_DIR=test.cache ../bin/convbin --icompress auto --input inputs/small.bin --icompress zx0 --input inputs/libload.8xv --oformat bin --compress zx7 --output test.cache2.bin | grep '3 hit(s), 0 miss(es)' > /dev/null && test -s test.cache2.bin"
+
+# Test: Cached output must match the freshly compressed output.
+run_test "cache_hit_assert" "cmp -s test.cache1.bin test.cache2.bin"
+
+# Test: Compress with the default effort as a reference for compression levels.
+run_test "compress_level_default" "../bin/convbin --input inputs/large.bin --oformat bin --compress zx7 --output test.level_default.bin"
+
+# Test: The highest compression level is the default.
+run_test "compress_level_max" "../bin/convbin --compress-level 5 --input inputs/large.bin --oformat bin --compress zx7 --output test.level5.bin && cmp -s test.level_default.bin test.level5.bin"
+
+# Test: The fastest compression level should not compress better than the default.
+run_test "compress_level_fast" "../bin/convbin --compress-level 1 --input inputs/large.bin --oformat bin --compress zx7 --output test.level1.bin && [ \"\$(wc -c < test.level1.bin)\" -ge \"\$(wc -c < test.level_default.bin)\" ]"
+
+# Test: Compression level must be within range.
+run_test_expect_fail "compress_level_invalid" "../bin/convbin --compress-level 6 --input inputs/small.bin --oformat bin --output test.level6.bin"
+
+# Test: Incompressible data should skip the compressors for compressed 8xp.
+run_test "compress_skip_incompressible" "../bin/convbin --iformat bin --input inputs/random_64k.bin -e zx7 --oformat 8xp-compressed --output test.skip.8xp --name TEST | grep -q 'Skipping compression'"
+
+# Test: Forcing compression should run the compressors anyway.
+run_test "compress_force" "! ../bin/convbin --compress-force --iformat bin --input inputs/random_64k.bin -e zx7 --oformat 8xp-compressed --output test.force.8xp --name TEST | grep -q 'Skipping compression'"
+
+# Test: Skipping compression should not change the output.
+run_test "compress_skip_assert" "cmp -s test.skip.8xp test.force.8xp && cmp -s test.skip.8xp.0.8xv test.force.8xp.0.8xv && cmp -s test.skip.8xp.1.8xv test.force.8xp.1.8xv"
+
+# Test: Compressible data should never be skipped.
+run_test "compress_no_skip_compressible" "! ../bin/convbin --iformat bin --input inputs/large.bin -e zx7 --oformat 8xp-compressed --output test.noskip.8xp --name TEST | grep -q 'Skipping compression'"
+
+# Test: A tight memory limit should fall back to a smaller zx0 window instead of failing.
+run_test "compress_mem_limit_fallback" "../bin/convbin --compress-mem-limit 4M --input inputs/large.bin --oformat bin --compress zx0 --output test.memlimit.bin | grep -q 'Memory limit reached'"
+
+# Test: A memory limit that is never reached should not change the output.
+run_test "compress_mem_limit_unreached" "../bin/convbin --compress-level 3 --input inputs/large.bin --oformat bin --compress zx0 --output test.memlimit_none.bin && ../bin/convbin --compress-level 3 --compress-mem-limit 1G --input inputs/large.bin --oformat bin --compress zx0 --output test.memlimit_1g.bin && cmp -s test.memlimit_none.bin test.memlimit_1g.bin"
+
+# Test: Memory limit must be a size.
+run_test_expect_fail "compress_mem_limit_invalid" "../bin/convbin --compress-mem-limit 4Q --input inputs/small.bin --oformat bin --output test.memlimit_invalid.bin"
+
+# Test: Block compression writes a block table, and each block decodes on its own.
+run_test "compress_blocks" "../bin/convbin --compress-block-size 8K --input inputs/large.bin --oformat bin --compress zx0 --output test.blocks.bin && test \"\$(od -An -tu1 -N3 test.blocks.bin | tr -d ' ')\" = 500 && head -c 8192 inputs/large.bin > test.blocks_first.bin && ../bin/convbin --input test.blocks_first.bin --oformat bin --compress zx0 --output test.blocks_first.zx0 && tail -c +34 test.blocks.bin | head -c \$(wc -c < test.blocks_first.zx0) | cmp -s - test.blocks_first.zx0"
+
+# Test: Block size must be between 1 byte and 16 MiB.
+run_test_expect_fail "compress_block_size_invalid" "../bin/convbin --compress-block-size 0 --input inputs/small.bin --oformat bin --compress zx0 --output test.blocks_invalid.bin"
+
+# Test: Programs cannot read the block table, so block compression is refused for them.
+run_test_expect_fail "compress_blocks_8xp" "../bin/convbin --compress-blocks --input inputs/large.bin --icompress zx0 --oformat 8xp --name BLOCKS --output test.blocks.8xp"
+
+# Test: Verified zx0 output decodes back to the input through the zx0 input format.
+run_test "verify_zx0_roundtrip" "../bin/convbin --verify --input inputs/large.bin --oformat bin --compress zx0 --output test.verify.zx0 && ../bin/convbin --iformat zx0 --input test.verify.zx0 --oformat bin --output test.verify_zx0.bin && cmp -s test.verify_zx0.bin inputs/large.bin"
+
+# Test: Verified zx7 output decodes back to the input through the zx7 input format.
+run_test "verify_zx7_roundtrip" "../bin/convbin --verify --input inputs/libload.8xv --oformat bin --compress zx7 --output test.verify.zx7 && ../bin/convbin --iformat zx7 --input test.verify.zx7 --oformat bin --output test.verify_zx7.bin && cmp -s test.verify_zx7.bin inputs/libload.8xv"
+
+# Test: A truncated stream is rejected by the zx0 input format.
+run_test_expect_fail "zx0_input_invalid" "head -c 64 /dev/zero > test.invalid.zx0 && ../bin/convbin --iformat zx0 --input test.invalid.zx0 --oformat bin --output test.invalid_zx0.bin"
+
+# Test: The goal decides the auto codec when zx7 is smaller but zx0 has the smaller footprint.
+run_test "compress_goal" "yes ab | head -c 37 > test.goal.bin && ../bin/convbin --input test.goal.bin --oformat bin --compress auto --output test.goal_size.bin | grep -q 'Chose zx7' && ../bin/convbin --compress-goal footprint --input test.goal.bin --oformat bin --compress auto --output test.goal_footprint.bin | grep -q 'Chose zx0'"
+
+# Test: Unknown compression goals are rejected.
+run_test_expect_fail "compress_goal_invalid" "../bin/convbin --compress-goal smallest --input inputs/small.bin --oformat bin --compress auto --output test.goal_invalid.bin"
+
+# Test: Chaining makes a repeated input almost free, and verifies.
+run_test "compress_chain" "../bin/convbin --icompress zx0 --input inputs/small.bin --oformat bin --output test.chain_one.bin && ../bin/convbin --compress-chain --verify --icompress zx0 --input inputs/small.bin --icompress zx0 --input inputs/small.bin --oformat bin --output test.chain_two.bin && [ \$(wc -c < test.chain_two.bin) -lt \$(( \$(wc -c < test.chain_one.bin) + 16 )) ]"
+
+# Test: A missing dictionary is an error.
+run_test_expect_fail "compress_dict_missing" "../bin/convbin --compress-dict inputs/missing.bin --icompress zx0 --input inputs/small.bin --oformat bin --output test.dict_missing.bin"
+
+# Test: Compressed split appvars are filled after compression, each holding a size and a zx0 stream.
+run_test "split_appvar_compressed" "rm -f test.split_zx0.* && ../bin/convbin --input inputs/large.bin --oformat 8xv-split --compress zx0 --maxvarsize 4096 --output test.split_zx0.8xv --name TEST && [ ! -e test.split_zx0.2.8xv ] && for i in 0 1; do ../bin/convbin --iformat 8x --input test.split_zx0.\$i.8xv --oformat bin --output test.split_zx0.\$i.bin && tail -c +4 test.split_zx0.\$i.bin > test.split_zx0.\$i.zx0 && ../bin/convbin --iformat zx0 --input test.split_zx0.\$i.zx0 --oformat bin --output test.split_zx0.\$i.out || exit 1; done && cat test.split_zx0.0.out test.split_zx0.1.out | cmp -s - inputs/large.bin"
+
+# Test: Compressed split appvars also round trip with zx7 chunks.
+run_test "split_appvar_compressed_zx7" "rm -f test.split_zx7.* && ../bin/convbin --input inputs/large.bin --oformat 8xv-split --compress zx7 --maxvarsize 4096 --output test.split_zx7.8xv --name TEST && [ ! -e test.split_zx7.3.8xv ] && for i in 0 1 2; do ../bin/convbin --iformat 8x --input test.split_zx7.\$i.8xv --oformat bin --output test.split_zx7.\$i.bin && tail -c +4 test.split_zx7.\$i.bin > test.split_zx7.\$i.zx7 && ../bin/convbin --iformat zx7 --input test.split_zx7.\$i.zx7 --oformat bin --output test.split_zx7.\$i.out || exit 1; done && cat test.split_zx7.0.out test.split_zx7.1.out test.split_zx7.2.out | cmp -s - inputs/large.bin"
+
+# Test: The fast parser produces streams that decompress to the input.
+run_test "compress_fast" "../bin/convbin --compress-fast --verify --input inputs/large.bin --oformat bin --compress zx0 --output test.fast_zx0.bin && ../bin/convbin --compress-fast --verify --input inputs/large.bin --oformat bin --compress zx7 --output test.fast_zx7.bin"
+
+# Test: Estimated sizes match the streams the compressors write.
+run_test "compress_estimate" "../bin/convbin --estimate --input inputs/large.bin > test.estimate.txt && ../bin/convbin --input inputs/large.bin --oformat bin --compress zx7 --output test.estimate_zx7.bin && ../bin/convbin --input inputs/large.bin --oformat bin --compress zx0 --output test.estimate_zx0.bin && test \"\$(awk 'NR == 2 { print \$3, \$5 }' test.estimate.txt)\" = \"\$(wc -c < test.estimate_zx7.bin) \$(wc -c < test.estimate_zx0.bin)\""
+
+# Test: Save a zx7 parse checkpoint for an output.
+run_test "compress_resume_prepare" "rm -rf test.resume.cache && ../bin/convbin --cache-dir test.resume.cache --input inputs/large.bin --oformat bin --compress zx7 --output test.resume.bin && ls test.resume.cache/*.state"
+
+# Test: Changing the tail resumes the parse, and the result matches a full compression.
+run_test "compress_resume" "head -c 30000 inputs/large.bin > test.resume_tail.bin && cat inputs/small.bin >> test.resume_tail.bin && ../bin/convbin --cache-dir test.resume.cache --input test.resume_tail.bin --oformat bin --compress zx7 --output test.resume.bin && ../bin/convbin --input test.resume_tail.bin --oformat bin --compress zx7 --output test.resume_full.bin && cmp -s test.resume.bin test.resume_full.bin"
+
+# Test: Auto mode saves and resumes the zx7 checkpoint from its helper thread.
+run_test "compress_resume_auto" "rm -rf test.resume_auto.cache && ../bin/convbin --cache-dir test.resume_auto.cache --input inputs/large.bin --oformat bin --compress auto --output test.resume_auto.bin && ls test.resume_auto.cache/*.state && ../bin/convbin --cache-dir test.resume_auto.cache --input test.resume_tail.bin --oformat bin --compress auto --output test.resume_auto.bin && ../bin/convbin --input test.resume_tail.bin --oformat bin --compress auto --output test.resume_auto_full.bin && cmp -s test.resume_auto.bin test.resume_auto_full.bin"
+
+# Test: Outputs of the same name in different directories keep separate checkpoints.
+run_test "compress_resume_paths" "rm -rf test.resume_paths.cache test.resume_a test.resume_b && mkdir test.resume_a test.resume_b && ../bin/convbin --cache-dir test.resume_paths.cache --input inputs/large.bin --oformat bin --compress zx7 --output test.resume_a/out.bin && ../bin/convbin --cache-dir test.resume_paths.cache --input test.resume_tail.bin --oformat bin --compress zx7 --output test.resume_b/out.bin && test \$(ls test.resume_paths.cache/*.state | wc -l) -eq 2"
+
+# Test: Building unchanged data again does not rewrite its checkpoint.
+run_test "compress_resume_unchanged" "touch -t 200001010000 test.resume_paths.cache/*.state && touch test.resume_paths.mark && find test.resume_paths.cache -type f ! -name '*.state' -exec rm {} + && ../bin/convbin --cache-dir test.resume_paths.cache --input inputs/large.bin --oformat bin --compress zx7 --output test.resume_a/out.bin && test -z \"\$(find test.resume_paths.cache -name '*.state' -newer test.resume_paths.mark)\""
+
+# Test: zx7 of a 2 MB input fits in 40 MB of address space, where ulimit -v is supported.
+run_test "compress_zx7_memory" "for i in \$(seq 60); do cat inputs/large.bin; done > test.zx7_mem.bin && (ulimit -v 40960 2>/dev/null || exit 0; ../bin/convbin --input test.zx7_mem.bin --oformat bin --compress zx7 --output test.zx7_mem.zx7)"
+
+# Test: A large input is mapped and compressed in place without changing the file.
+run_test "input_mapped" "cat inputs/large.bin inputs/large.bin > test.mapped.bin && ../bin/convbin --verify --icompress zx7 --input test.mapped.bin --oformat bin --output test.mapped.zx7 && cat inputs/large.bin inputs/large.bin | cmp -s - test.mapped.bin && ../bin/convbin --iformat zx7 --input test.mapped.zx7 --oformat bin --output test.mapped.out && cmp -s test.mapped.bin test.mapped.out"
+
+# Test: Inputs loaded in parallel report the first bad input in command line order, and only that one.
+run_test "jobs_input_error_order" "! ../bin/convbin --jobs 4 --input inputs/small.bin --input inputs/missing_a.bin --iformat csv --input inputs/csv.csv --input inputs/missing_b.bin --oformat bin --output test.jobs_error.bin > test.jobs_error.txt && grep -q missing_a test.jobs_error.txt && ! grep -q missing_b test.jobs_error.txt"
+
+# Test: Inputs loaded in parallel print exactly what a serial run prints.
+run_test "jobs_input_error_output" "! ../bin/convbin --jobs 1 --input inputs/small.bin --input inputs/missing_a.bin --iformat csv --input inputs/csv.csv --oformat bin --output test.jobs_error.bin > test.jobs_error1.txt && ! ../bin/convbin --jobs 4 --input inputs/small.bin --input inputs/missing_a.bin --iformat csv --input inputs/csv.csv --oformat bin --output test.jobs_error.bin > test.jobs_error4.txt && cmp -s test.jobs_error1.txt test.jobs_error4.txt"
+
+# Test: CSV values parse as C literals, with spaces ignored and out of range values clamped.
+run_test "csv_values" "printf '1 2,0x1F, 0 X1f,077,08,0b101,-0,-1,256,abc\\r\\n,,7\\t9' > test.values.csv && ../bin/convbin --iformat csv --input test.values.csv --oformat bin --output test.values.bin && printf '\\014\\037\\037\\077\\000\\005\\000\\377\\377\\000\\007\\011' | cmp -s - test.values.bin"
+
+# Test: A 64 MB CSV streams to C source in 40 MB of address space, where ulimit -v is supported.
+run_test "csv_stream_memory" "yes '1,0x02,3' | head -c 67108864 > test.stream.csv && (ulimit -v 40960 2>/dev/null || exit 0; ../bin/convbin --iformat csv --input test.stream.csv --oformat c --name TEST --output test.stream.c) && grep -q 'TEST\\[22369622\\]' test.stream.c"
+
+# Test: A response file adds its inputs in order, with per-line mode overrides, past the old 256 input limit.
+run_test "input_response_file" "../bin/convbin --iformat csv --input inputs/csv.csv --iformat bin --input inputs/small.bin --icompress zx7 --input inputs/large.bin --oformat bin --output test.response_ref.bin && printf '# inputs\\ninputs/csv.csv -j csv\\n\\ninputs/small.bin\\n\\\"inputs/large.bin\\\" --icompress zx7\\n' > test.response.txt && for i in \$(seq 300); do echo inputs/small.bin; done > test.response_many.txt && ../bin/convbin --input @test.response.txt --input @test.response_many.txt --oformat bin --output test.response.bin && for i in \$(seq 300); do cat inputs/small.bin; done | cat test.response_ref.bin - | cmp -s - test.response.bin"
+
 echo
 echo "========== Test Summary =========="
 echo "Total:  $total_tests"